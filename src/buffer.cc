@@ -200,7 +200,27 @@ Buffer::Modification Buffer::Modification::inverse() const
     return {type == Insert ? Erase : Insert, coord, content};
 }
 
+Vector<Diff> Buffer::line_diff(const BufferLines& lines, const BufferLines& new_lines)
+{
+    Vector<Diff> diff;
+    for_each_diff(lines.begin(), (int)lines.size(),
+                  new_lines.begin(), (int)new_lines.size(),
+                  [&diff](DiffOp op, int len)
+                  { diff.push_back({op, len}); },
+                  [](const StringDataPtr& lhs, const StringDataPtr& rhs)
+                  { return lhs->strview() == rhs->strview(); });
+    return diff;
+}
+
 void Buffer::reload(BufferLines lines, ByteOrderMark bom, EolFormat eolformat, FinalEol finaleol, FsStatus fs_status)
+{
+    Vector<Diff> diff;
+    if (not (m_flags & Flags::NoUndo))
+        diff = line_diff(m_lines, lines);
+    reload(std::move(lines), diff, bom, eolformat, finaleol, fs_status);
+}
+
+void Buffer::reload(BufferLines lines, ConstArrayView<Diff> diff, ByteOrderMark bom, EolFormat eolformat, FinalEol finaleol, FsStatus fs_status)
 {
     const bool record_undo = not (m_flags & Flags::NoUndo);
 
@@ -219,14 +239,6 @@ void Buffer::reload(BufferLines lines, ByteOrderMark bom, EolFormat eolformat, F
     }
     else
     {
-        Vector<Diff> diff;
-        for_each_diff(m_lines.begin(), m_lines.size(),
-                      lines.begin(), lines.size(),
-                      [&diff](DiffOp op, int len)
-                      { diff.push_back({op, len}); },
-                      [](const StringDataPtr& lhs, const StringDataPtr& rhs)
-                      { return lhs->strview() == rhs->strview(); });
-
         auto read_it = m_lines.begin();
         auto write_it = m_lines.begin();
         auto new_it = lines.begin();
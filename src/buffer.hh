@@ -69,6 +69,7 @@ constexpr auto enum_desc(Meta::Type<FinalEol>)
 }
 
 class Buffer;
+struct Diff;
 
 // A BufferIterator permits to iterate over the characters of a buffer
 class BufferIterator
@@ -211,6 +212,10 @@ public:
     const StringDataPtr& line_storage(LineCount line) const
     { return m_lines.get_storage(line); }
 
+    // line storage is immutable, so a snapshot can be read from worker
+    // threads while the buffer keeps being modified
+    BufferLines lines_snapshot() const { return m_lines; }
+
     // returns an iterator at given coordinates. clamp line_and_column
     BufferIterator iterator_at(BufferCoord coord) const;
 
@@ -237,6 +242,12 @@ public:
                                  String client_name = {});
 
     void reload(BufferLines lines, ByteOrderMark bom, EolFormat eolformat, FinalEol finaleol, FsStatus status);
+    // same as above, diff going from the current lines to the new ones
+    void reload(BufferLines lines, ConstArrayView<Diff> diff, ByteOrderMark bom, EolFormat eolformat, FinalEol finaleol, FsStatus status);
+
+    // only reads the line contents, so that it can run on line snapshots
+    // from a worker thread
+    static Vector<Diff> line_diff(const BufferLines& lines, const BufferLines& new_lines);
 
     void check_invariant() const;
 
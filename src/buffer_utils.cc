@@ -8,6 +8,8 @@
 #include "file.hh"
 #include "selection.hh"
 #include "changes.hh"
+#include "diff.hh"
+#include "worker_pool.hh"
 
 #include <unistd.h>
 
@@ -171,6 +173,27 @@ void reload_file_buffer(Buffer& buffer)
     buffer.flags() &= ~Buffer::Flags::New;
 }
 
+WorkerTask reload_file_buffer_async(Buffer& buffer, Function<void ()> done)
+{
+    kak_assert(buffer.flags() & Buffer::Flags::File and not (buffer.flags() & Buffer::Flags::NoUndo));
+    return parse_file(buffer.filename(), [&](BufferLines&& lines, ByteOrderMark bom, EolFormat eolformat, FinalEol finaleol, FsStatus fs_status) {
+        auto work = [old_lines = buffer.lines_snapshot(), new_lines = lines] {
+            return Buffer::line_diff(old_lines, new_lines);
+        };
+        return WorkerPool::instance().submit(std::move(work),
+            [&buffer, timestamp = buffer.timestamp(), lines = std::move(lines),
+             bom, eolformat, finaleol, fs_status, done = std::move(done)](Vector<Diff> diff) mutable {
+                // the diff does not apply if the buffer was modified in the meantime
+                if (buffer.timestamp() == timestamp)
+                    buffer.reload(std::move(lines), diff, bom, eolformat, finaleol, fs_status);
+                else
+                    buffer.reload(std::move(lines), bom, eolformat, finaleol, fs_status);
+                buffer.flags() &= ~Buffer::Flags::New;
+                done();
+            });
+    });
+}
+
 void write_buffer_to_fd(Buffer& buffer, int fd, Optional<FinalEol> finaleol)
 {
     if (not finaleol)
@@ -2,6 +2,7 @@
 #define buffer_utils_hh_INCLUDED
 
 #include "buffer.hh"
+#include "function.hh"
 #include "selection.hh"
 
 #include "utf8_iterator.hh"
@@ -81,6 +82,11 @@ Buffer* open_or_create_file_buffer(StringView filename,
                                    Buffer::Flags flags = Buffer::Flags::None);
 void reload_file_buffer(Buffer& buffer);
 
+class WorkerTask;
+// reloads the buffer once the diff with its current content was computed on
+// a worker thread, then calls done. The buffer must outlive the task.
+WorkerTask reload_file_buffer_async(Buffer& buffer, Function<void ()> done);
+
 enum class WriteFlags
 {
     None  = 0,
@@ -49,16 +49,24 @@ template<typename RangeContainer>
 void update_forward(ConstArrayView<Buffer::Change> changes, RangeContainer& ranges)
 {
     ForwardChangesTracker changes_tracker;
-    auto advance_while_relevant = [&, it = changes.begin()]
-                                  (const BufferCoord& pos) mutable {
-        while (it != changes.end() and changes_tracker.relevant(*it, pos))
-            changes_tracker.update(*it++);
+    auto change_it = changes.begin();
+    auto advance_while_relevant = [&](const BufferCoord& pos) {
+        while (change_it != changes.end() and changes_tracker.relevant(*change_it, pos))
+            changes_tracker.update(*change_it++);
     };
 
     auto range_it = std::lower_bound(ranges.begin(), ranges.end(), changes.front(),
                                      [](auto& range, const Buffer::Change& change) { return get_last(range) < change.begin; });
     for (auto end = ranges.end(); range_it != end; ++range_it)
+    {
+        // Once every change is applied, ranges starting on a line after the last
+        // one are unchanged unless the changes added or removed lines
+        if (change_it == changes.end() and
+            changes_tracker.cur_pos.line == changes_tracker.old_pos.line and
+            get_first(*range_it).line > changes_tracker.old_pos.line)
+            break;
         update_range(changes_tracker, *range_it, advance_while_relevant);
+    }
 }
 
 template<typename RangeContainer>
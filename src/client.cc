@@ -28,6 +28,10 @@
 namespace Kakoune
 {
 
+// buffers with at least that many lines get their reload diff computed on a
+// worker thread, smaller ones are diffed faster than a redraw
+constexpr LineCount async_reload_min_lines = 10000;
+
 Client::Client(UniquePtr<UserInterface>&& ui,
                UniquePtr<Window>&& window,
                SelectionList selections, int pid,
@@ -39,7 +43,12 @@ Client::Client(UniquePtr<UserInterface>&& ui,
       m_on_exit{std::move(on_exit)},
       m_env_vars(std::move(env_vars)),
       m_input_handler{std::move(selections), Context::Flags::None,
-                      std::move(name)}
+                      std::move(name)},
+      m_prefetch_timer{TimePoint::max(), [this](Timer& timer) {
+          if (m_window->prefetch_highlighting(context(), m_prefetch_deadline))
+              timer.set_next_date(Clock::now());
+      }},
+      m_redraw_timer{TimePoint::max(), [](Timer& timer) { timer.disable(); }}
 {
     m_window->set_client(this);
 
@@ -73,8 +82,10 @@ Client::Client(UniquePtr<UserInterface>&& ui,
             m_pending_keys.push_back(key);
     });
     m_ui->set_on_paste([this](StringView content) {
+        m_input_since_redraw = true;
         context().input_handler().paste(content);
     });
+    m_ui->set_on_redraw([this] { force_redraw(true); });
 
     m_window->hooks().run_hook(Hook::WinDisplay, m_window->buffer().name(), context());
 
@@ -128,6 +139,8 @@ bool Client::process_pending_inputs()
             context().hooks().run_hook(Hook::RuntimeError, error.what(), context());
         }
     }
+    if (not keys.empty())
+        m_input_since_redraw = true;
     return not keys.empty();
 }
 
@@ -204,6 +217,9 @@ void Client::change_buffer(Buffer& buffer, Optional<FunctionRef<void()>> set_sel
     if (context().buffer().flags() & Buffer::Flags::Locked)
         throw runtime_error("Changing buffer is not allowed while current buffer is locked");
 
+    // the reload will be checked again when this buffer gets displayed
+    m_reload_task.cancel();
+
     buffer.flags() |= Buffer::Flags::Locked;
     OnScopeEnd unlock{[&] { buffer.flags() &= ~Buffer::Flags::Locked; }};
 
@@ -247,16 +263,44 @@ void Client::redraw_ifn()
 {
     Window& window = context().window();
     if (window.needs_redraw(context()))
+    {
+        // Coalesce redraws that were neither requested nor caused by our
+        // input, such as a buffer being filled by a fifo, the timer wakes
+        // up the event loop once the interval is elapsed.
+        if (m_ui_pending == 0 and not m_input_since_redraw)
+        {
+            auto interval = std::chrono::milliseconds{context().options()["redraw_interval"].get<int>()};
+            auto next_redraw = m_last_redraw + interval;
+            if (Clock::now() < next_redraw)
+            {
+                m_redraw_timer.set_next_date(next_redraw);
+                return;
+            }
+        }
         m_ui_pending |= Draw;
+    }
+    m_input_since_redraw = false;
 
     const auto& faces = context().faces();
 
     if (m_ui_pending & Draw)
     {
+        m_last_redraw = Clock::now();
+        m_redraw_timer.disable();
         auto& display_buffer = window.update_display_buffer(context());
         auto cursor_pos = window.display_coord(context().selections().main().cursor()).value_or(DisplayCoord{});
         m_ui->draw(display_buffer, cursor_pos, faces["Default"], faces["BufferPadding"],
                    window.last_display_setup().widget_columns);
+
+        const auto& options = context().options();
+        if (auto budget = options["idle_highlight_budget"].get<int>(); budget > 0)
+        {
+            auto start = Clock::now() + std::chrono::milliseconds{options["idle_timeout"].get<int>()};
+            m_prefetch_timer.set_next_date(start);
+            m_prefetch_deadline = start + std::chrono::milliseconds{budget};
+        }
+        else
+            m_prefetch_timer.disable();
     }
 
     const bool update_menu_anchor = (m_ui_pending & Draw) and not (m_ui_pending & MenuHide) and
@@ -327,13 +371,23 @@ void Client::force_redraw(bool full)
 void Client::reload_buffer()
 {
     Buffer& buffer = context().buffer();
-    try
-    {
-        reload_file_buffer(buffer);
+    auto on_reloaded = [this, &buffer] {
         context().print_status({ format("'{}' reloaded", buffer.display_name()),
                                  context().faces()["Information"] });
 
         m_window->hooks().run_hook(Hook::BufReload, buffer.name(), context());
+    };
+
+    try
+    {
+        // diffing large buffers can take a while, do not block the editor meanwhile
+        if (buffer.line_count() >= async_reload_min_lines and not (buffer.flags() & Buffer::Flags::NoUndo))
+            m_reload_task = reload_file_buffer_async(buffer, on_reloaded);
+        else
+        {
+            reload_file_buffer(buffer);
+            on_reloaded();
+        }
     }
     catch (runtime_error& error)
     {
@@ -401,6 +455,9 @@ void Client::check_if_buffer_needs_reloading()
         return;
 
     Buffer& buffer = context().buffer();
+    if (any_of(ClientManager::instance(), [&](auto& client) {
+            return &client->context().buffer() == &buffer and client->m_reload_task.pending(); }))
+        return;
     auto reload = context().options()["autoreload"].get<Autoreload>();
     if (not (buffer.flags() & Buffer::Flags::File) or reload == Autoreload::No)
         return;
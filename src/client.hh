@@ -11,6 +11,7 @@
 #include "unique_ptr.hh"
 #include "utils.hh"
 #include "option.hh"
+#include "worker_pool.hh"
 #include "enum.hh"
 
 namespace Kakoune
@@ -152,7 +153,15 @@ private:
 
     Vector<Key, MemoryDomain::Client> m_pending_keys;
 
+    Timer m_prefetch_timer;
+    TimePoint m_prefetch_deadline;
+
+    Timer m_redraw_timer;
+    TimePoint m_last_redraw;
+    bool m_input_since_redraw = false;
+
     bool m_buffer_reload_dialog_opened = false;
+    WorkerTask m_reload_task;
 };
 
 enum class Autoreload
@@ -360,7 +360,7 @@ void expand_token(Token&& token, const Context& context, const ShellContext& she
     {
         auto str = ShellManager::instance().eval(
             content, context, StringView{},
-            ShellManager::Flags::WaitForStdout,
+            ShellManager::Flags::WaitForStdout | ShellManager::Flags::Cacheable,
             shell_context).first;
 
         if (not str.empty() and str.back() == '\n')
@@ -541,6 +541,7 @@ void CommandManager::execute_single_command(CommandParameters params,
     ProfileScope profile{debug_flags, [&](std::chrono::microseconds duration) {
         write_to_debug_buffer(format("command {} took {} us", params[0], duration.count()));
     }};
+    ProfileReportScope profile_report{debug_flags, "command", params[0]};
 
     command_it->value.func({{params.begin()+1, params.end()}, command_it->value.param_desc},
                            context, shell_context);
@@ -552,6 +553,7 @@ void CommandManager::execute(StringView command_line,
     CommandParser parser(command_line);
 
     LocalScope local_scope(context);
+    auto env_var_cache = ShellManager::instance().env_var_cache_scope();
     ByteCount command_pos{};
     Vector<String> params;
     while (true)
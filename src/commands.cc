@@ -1609,7 +1609,8 @@ const CommandDesc debug_cmd = {
     make_completer(
         [](const Context& context, StringView prefix, ByteCount cursor_pos) -> Completions {
                auto c = {"info", "buffers", "options", "memory", "shared-strings",
-                         "profile-hash-maps", "faces", "mappings", "regex", "registers"};
+                         "profile-hash-maps", "faces", "mappings", "regex", "registers",
+                         "hooks", "profile-report"};
                return { 0_byte, cursor_pos, complete(prefix, cursor_pos, c), Completions::Flags::Menu };
     }),
     [](const ParametersParser& parser, Context& context, const ShellContext&)
@@ -1701,6 +1702,18 @@ const CommandDesc debug_cmd = {
                 }
             }
         }
+        else if (parser[0] == "hooks")
+        {
+            write_to_debug_buffer("Hooks:");
+            context.hooks().debug_stats();
+        }
+        else if (parser[0] == "profile-report")
+        {
+            if (parser.positional_count() > 1 and parser[1] == "reset")
+                reset_profile_report();
+            else
+                write_profile_report(parser.positional_count() > 1 ? parser[1] : "total");
+        }
         else if (parser[0] == "regex")
         {
             if (parser.positional_count() != 2)
@@ -2373,6 +2386,58 @@ const CommandDesc on_key_cmd = {
     }
 };
 
+const CommandDesc async_shell_cmd = {
+    "async-shell",
+    nullptr,
+    "async-shell [<switches>] <script> <command>: run <script> in a shell without waiting for it, "
+    "then execute <command> with its output available in the `output` value and its exit status "
+    "in the `exit_status` value",
+    ParameterDesc{
+        { { "group", { ArgCompleter{}, "cancel the unfinished scripts started in the same group" } } },
+        ParameterDesc::Flags::None, 2, 2
+    },
+    CommandFlags::None,
+    CommandHelper{},
+    CommandCompleter{},
+    [](const ParametersParser& parser, Context& context, const ShellContext& shell_context)
+    {
+        // <command> runs in the current client, or in a draft context of the current
+        // buffer, and is dropped if it does not exist anymore once the script exited
+        String client = context.has_client() ? context.client().context().name() : String{};
+        String buffer = context.has_buffer() ? context.buffer().name() : String{};
+        String queue = not client.empty() ? "client:" + client : (not buffer.empty() ? "buffer:" + buffer : String{});
+
+        ShellManager::instance().eval_async(
+            parser[0], context, queue, parser.get_switch("group").value_or(StringView{}),
+            [client, buffer, command=parser[1], sc=CapturedShellContext{shell_context}]
+            (String output, int status) mutable {
+                if (not output.empty() and output.back() == '\n')
+                    output.resize(output.length() - 1, 0);
+                sc.env_vars["output"_sv] = std::move(output);
+                sc.env_vars["exit_status"_sv] = to_string(status);
+
+                if (not client.empty())
+                {
+                    if (auto* target = ClientManager::instance().get_client_ifp(client))
+                        CommandManager::instance().execute(command, target->context(), sc);
+                }
+                else if (not buffer.empty())
+                {
+                    if (auto* target = BufferManager::instance().get_buffer_ifp(buffer))
+                    {
+                        InputHandler input_handler{{*target, Selection{}}, Context::Flags::Draft};
+                        CommandManager::instance().execute(command, input_handler.context(), sc);
+                    }
+                }
+                else
+                {
+                    Context empty_context{Context::EmptyContextFlag{}};
+                    CommandManager::instance().execute(command, empty_context, sc);
+                }
+            }, shell_context);
+    }
+};
+
 const CommandDesc info_cmd = {
     "info",
     nullptr,
@@ -2835,6 +2900,7 @@ void register_commands()
     register_command(evaluate_commands_cmd);
     register_command(prompt_cmd);
     register_command(on_key_cmd);
+    register_command(async_shell_cmd);
     register_command(info_cmd);
     register_command(try_catch_cmd);
     register_command(set_face_cmd);
@@ -17,6 +17,7 @@ enum class DebugFlags
     Profile  = 1 << 2,
     Keys     = 1 << 3,
     Commands = 1 << 4,
+    ProfileReport = 1 << 5,
 };
 
 constexpr bool with_bit_ops(Meta::Type<DebugFlags>) { return true; }
@@ -29,6 +30,7 @@ constexpr auto enum_desc(Meta::Type<DebugFlags>)
         { DebugFlags::Profile, "profile" },
         { DebugFlags::Keys, "keys" },
         { DebugFlags::Commands, "commands" },
+        { DebugFlags::ProfileReport, "profile-report" },
     });
 }
 
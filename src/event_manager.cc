@@ -1,12 +1,23 @@
 #include "event_manager.hh"
 
+#include "exception.hh"
 #include "flags.hh"
+#include "format.hh"
 #include "ranges.hh"
+#include "unit_tests.hh"
 
 #if defined(__sun__)
 #include <cstring>
 #endif
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <poll.h>
+#include <climits>
+#include <cstring>
+#endif
+
+#include <fcntl.h>
 #include <unistd.h>
 
 namespace Kakoune
@@ -15,12 +26,20 @@ namespace Kakoune
 FDWatcher::FDWatcher(int fd, FdEvents events, EventMode mode, Callback callback)
     : m_fd{fd}, m_events{events}, m_mode{mode}, m_callback{std::move(callback)}
 {
-    EventManager::instance().m_fd_watchers.push_back(this);
+    EventManager::instance().register_watcher(*this);
 }
 
 FDWatcher::~FDWatcher()
 {
-    unordered_erase(EventManager::instance().m_fd_watchers, this);
+    EventManager::instance().unregister_watcher(*this, m_fd);
+}
+
+void FDWatcher::set_events(FdEvents events)
+{
+    if (events == m_events)
+        return;
+    m_events = events;
+    EventManager::instance().update_watcher(*this, m_fd);
 }
 
 void FDWatcher::run(FdEvents events, EventMode mode)
@@ -28,12 +47,21 @@ void FDWatcher::run(FdEvents events, EventMode mode)
     m_callback(*this, events, mode);
 }
 
+void FDWatcher::reset_fd(int fd)
+{
+    if (fd == m_fd)
+        return;
+    const int old_fd = std::exchange(m_fd, fd);
+    EventManager::instance().update_watcher(*this, old_fd);
+}
+
 void FDWatcher::close_fd()
 {
     if (m_fd != -1)
     {
-        close(m_fd);
-        m_fd = -1;
+        const int fd = m_fd;
+        disable(); // unregister before closing so that the fd can be reused
+        close(fd);
     }
 }
 
@@ -41,13 +69,20 @@ Timer::Timer(TimePoint date, Callback callback, EventMode mode)
     : m_date{date}, m_mode(mode), m_callback{std::move(callback)}
 {
     if (m_callback and EventManager::has_instance())
-        EventManager::instance().m_timers.push_back(this);
+        EventManager::instance().register_timer(*this);
 }
 
 Timer::~Timer()
 {
-    if (m_callback and EventManager::has_instance())
-        unordered_erase(EventManager::instance().m_timers, this);
+    if (m_heap_index != unregistered)
+        EventManager::instance().unregister_timer(*this);
+}
+
+void Timer::set_next_date(TimePoint date)
+{
+    m_date = date;
+    if (m_heap_index != unregistered)
+        EventManager::instance().sift_timer(m_heap_index);
 }
 
 void Timer::run(EventMode mode)
@@ -55,26 +90,326 @@ void Timer::run(EventMode mode)
     kak_assert(m_callback);
     if (mode == m_mode)
     {
-        m_date = TimePoint::max();
+        disable();
         m_callback(*this);
     }
     else // try again a little later
-        m_date = Clock::now() + std::chrono::milliseconds{10};
+        set_next_date(Clock::now() + std::chrono::milliseconds{10});
 }
 
 EventManager::EventManager()
 {
     FD_ZERO(&m_forced_fd);
+#if defined(__linux__)
+    open_epoll();
+#endif
 }
 
 EventManager::~EventManager()
 {
     kak_assert(m_fd_watchers.empty());
     kak_assert(m_timers.empty());
+#if defined(__linux__)
+    close_epoll();
+#endif
 }
 
+void EventManager::register_watcher(FDWatcher& watcher)
+{
+    m_fd_watchers.push_back(&watcher);
+#if defined(__linux__)
+    epoll_add(watcher);
+#endif
+}
+
+void EventManager::unregister_watcher(FDWatcher& watcher, int fd)
+{
+    unordered_erase(m_fd_watchers, &watcher);
+#if defined(__linux__)
+    epoll_remove(watcher, fd);
+#endif
+}
+
+void EventManager::register_timer(Timer& timer)
+{
+    timer.m_heap_index = m_timers.size();
+    m_timers.push_back(&timer);
+    sift_timer(timer.m_heap_index);
+}
+
+void EventManager::unregister_timer(Timer& timer)
+{
+    const size_t index = std::exchange(timer.m_heap_index, Timer::unregistered);
+    Timer* last = m_timers.back();
+    m_timers.pop_back();
+    if (last != &timer)
+    {
+        m_timers[index] = last;
+        last->m_heap_index = index;
+        sift_timer(index);
+    }
+
+    for (auto& due : m_due_timers)
+    {
+        if (due == &timer)
+            due = nullptr;
+    }
+}
+
+// move the timer at index up or down the heap until it is ordered
+void EventManager::sift_timer(size_t index)
+{
+    auto date = [this](size_t i) { return m_timers[i]->next_date(); };
+    auto swap = [this](size_t i, size_t j) {
+        std::swap(m_timers[i], m_timers[j]);
+        m_timers[i]->m_heap_index = i;
+        m_timers[j]->m_heap_index = j;
+    };
+
+    while (index > 0 and date(index) < date((index - 1) / 2))
+    {
+        swap(index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+
+    while (true)
+    {
+        size_t earliest = index;
+        for (size_t child : {2 * index + 1, 2 * index + 2})
+        {
+            if (child < m_timers.size() and date(child) < date(earliest))
+                earliest = child;
+        }
+        if (earliest == index)
+            return;
+        swap(index, earliest);
+        index = earliest;
+    }
+}
+
+#if defined(__linux__)
+
+static uint32_t to_epoll_events(FdEvents events)
+{
+    return ((events & FdEvents::Read) ? EPOLLIN : 0u) |
+           ((events & FdEvents::Write) ? EPOLLOUT : 0u) |
+           ((events & FdEvents::Except) ? EPOLLPRI : 0u);
+}
+
+static FdEvents to_fd_events(uint32_t events, FdEvents watched)
+{
+    FdEvents res = ((events & EPOLLIN) ? FdEvents::Read : FdEvents::None) |
+                   ((events & EPOLLOUT) ? FdEvents::Write : FdEvents::None) |
+                   ((events & EPOLLPRI) ? FdEvents::Except : FdEvents::None);
+    // select reports hung up fds as ready, so that reading or writing them fails
+    if (events & (EPOLLHUP | EPOLLERR))
+        res |= (FdEvents)(watched & (FdEvents::Read | FdEvents::Write));
+    return res;
+}
+
+static bool epoll_register(int epoll_fd, int op, int fd, FdEvents events)
+{
+    epoll_event event{to_epoll_events(events), {}};
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, op, fd, &event) == 0)
+        return true;
+    // a closed fd stays registered while a duplicate of it is open elsewhere
+    return op == EPOLL_CTL_ADD and errno == EEXIST and
+           epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0;
+}
+
+void EventManager::open_epoll()
+{
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_urgent_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1 or m_urgent_epoll_fd == -1)
+        throw runtime_error(format("unable to create epoll instance: {}", strerror(errno)));
+
+    m_watcher_by_fd.clear();
+    m_always_ready_watchers.clear();
+    for (auto* watcher : m_fd_watchers)
+        epoll_add(*watcher);
+}
+
+void EventManager::close_epoll()
+{
+    for (int* fd : {&m_epoll_fd, &m_urgent_epoll_fd})
+    {
+        if (*fd != -1)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+void EventManager::epoll_add(FDWatcher& watcher)
+{
+    const int fd = watcher.fd();
+    if (fd < 0 or watcher.events() == FdEvents::None)
+        return;
+
+    if ((size_t)fd >= m_watcher_by_fd.size())
+        m_watcher_by_fd.resize(fd + 1, nullptr);
+    if (m_watcher_by_fd[fd] != nullptr) // already watched by another watcher
+        return;
+
+    m_watcher_by_fd[fd] = &watcher;
+    if (not epoll_register(m_epoll_fd, EPOLL_CTL_ADD, fd, watcher.events()))
+    {
+        if (errno == EPERM) // regular files, that select considers always ready
+            m_always_ready_watchers.push_back(&watcher);
+        return;
+    }
+    if (watcher.mode() == EventMode::Urgent)
+        epoll_register(m_urgent_epoll_fd, EPOLL_CTL_ADD, fd, watcher.events());
+}
+
+void EventManager::epoll_remove(FDWatcher& watcher, int fd)
+{
+    if (fd < 0 or (size_t)fd >= m_watcher_by_fd.size() or m_watcher_by_fd[fd] != &watcher)
+        return;
+
+    m_watcher_by_fd[fd] = nullptr;
+    if (auto it = find(m_always_ready_watchers, &watcher); it != m_always_ready_watchers.end())
+        m_always_ready_watchers.erase(it);
+    else
+    {
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        if (watcher.mode() == EventMode::Urgent)
+            epoll_ctl(m_urgent_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    // another watcher might have been waiting for that fd
+    for (auto* other : m_fd_watchers)
+    {
+        if (other == &watcher or other->fd() != fd)
+            continue;
+        epoll_add(*other);
+        if (m_watcher_by_fd[fd] != nullptr)
+            break;
+    }
+}
+
+void EventManager::update_watcher(FDWatcher& watcher, int old_fd)
+{
+    const int fd = watcher.fd();
+    if (fd == old_fd and fd >= 0 and watcher.events() != FdEvents::None and
+        (size_t)fd < m_watcher_by_fd.size() and m_watcher_by_fd[fd] == &watcher and
+        not contains(m_always_ready_watchers, &watcher))
+    {
+        epoll_register(m_epoll_fd, EPOLL_CTL_MOD, fd, watcher.events());
+        if (watcher.mode() == EventMode::Urgent)
+            epoll_register(m_urgent_epoll_fd, EPOLL_CTL_MOD, fd, watcher.events());
+        return;
+    }
+
+    epoll_remove(watcher, old_fd);
+    epoll_add(watcher);
+}
+
+void EventManager::reset_after_fork()
+{
+    close_epoll();
+    open_epoll();
+}
+
+#else
+
+void EventManager::update_watcher(FDWatcher&, int) {}
+
+void EventManager::reset_after_fork() {}
+
+#endif
+
 bool EventManager::handle_next_events(EventMode mode, sigset_t* sigmask, Optional<Nanoseconds> timeout)
 {
+    // forced fds are dispatched once we return from waiting, do not wait for them
+    if (m_has_forced_fd)
+        timeout = Nanoseconds{};
+
+    if (not m_timers.empty())
+    {
+        auto next_date = m_timers.front()->next_date();
+        if (next_date != TimePoint::max())
+        {
+            auto remaining = std::max(Nanoseconds(0),
+                                      std::chrono::duration_cast<Nanoseconds>(next_date - Clock::now()));
+            timeout = timeout ? std::min(*timeout, remaining) : remaining;
+        }
+    }
+
+#if defined(__linux__)
+    if (not m_always_ready_watchers.empty())
+        timeout = Nanoseconds{};
+
+    // round up so that we do not wake up right before a timer is due
+    const int timeout_ms = timeout.map([](Nanoseconds nsecs) {
+        return (int)std::min<Nanoseconds::rep>(INT_MAX, (nsecs.count() + 999'999) / 1'000'000);
+    }).value_or(-1);
+
+    epoll_event ready[64];
+    int res = epoll_pwait(mode == EventMode::Urgent ? m_urgent_epoll_fd : m_epoll_fd,
+                          ready, (int)std::size(ready), timeout_ms, sigmask);
+    const size_t wait_count = ++m_wait_count;
+
+    // copy forced fds *after* epoll_pwait, so that signal handlers can write to
+    // m_forced_fd, interupt epoll_pwait, and directly be serviced.
+    const bool has_forced = std::exchange(m_has_forced_fd, false);
+    fd_set forced = m_forced_fd;
+    FD_ZERO(&m_forced_fd);
+
+    auto take_forced = [&](int fd) {
+        if (not has_forced or fd >= FD_SETSIZE or not FD_ISSET(fd, &forced))
+            return FdEvents::None;
+        FD_CLR(fd, &forced);
+        return FdEvents::Read;
+    };
+
+    // look the watcher up at each dispatch, as callbacks can remove watchers
+    auto dispatch = [&](int fd, FdEvents events) {
+        FDWatcher* watcher = (size_t)fd < m_watcher_by_fd.size() ? m_watcher_by_fd[fd] : nullptr;
+        if (not watcher)
+        {
+            auto it = find_if(m_fd_watchers, [fd](const FDWatcher* w){ return w->fd() == fd; });
+            watcher = it != m_fd_watchers.end() ? *it : nullptr;
+        }
+        if (watcher and events != FdEvents::None)
+            watcher->run(events, mode);
+    };
+
+    for (int i = 0; i < res; ++i)
+    {
+        const int fd = ready[i].data.fd;
+        FDWatcher* watcher = (size_t)fd < m_watcher_by_fd.size() ? m_watcher_by_fd[fd] : nullptr;
+        // a callback handled events in a nested call, which might have consumed
+        // what made that fd ready, check it again instead of blocking on it
+        if (m_wait_count != wait_count)
+        {
+            pollfd pfd{fd, (short)to_epoll_events(watcher ? watcher->events() : FdEvents::None), 0};
+            ready[i].events = poll(&pfd, 1, 0) == 1 ? (uint32_t)pfd.revents : 0u;
+        }
+        dispatch(fd, to_fd_events(ready[i].events, watcher ? watcher->events() : FdEvents::None) | take_forced(fd));
+    }
+
+    if (not m_always_ready_watchers.empty())
+    {
+        auto always_ready = m_always_ready_watchers; // copy as callbacks can mutate it
+        for (auto* watcher : always_ready)
+        {
+            if (not contains(m_always_ready_watchers, watcher) or
+                (mode == EventMode::Urgent and watcher->mode() == EventMode::Normal))
+                continue;
+            const int fd = watcher->fd();
+            dispatch(fd, (FdEvents)(watcher->events() & (FdEvents::Read | FdEvents::Write)) | take_forced(fd));
+            res = std::max(res, 0) + 1;
+        }
+    }
+
+    if (has_forced)
+    {
+        for (int fd = 0; fd < FD_SETSIZE; ++fd)
+            dispatch(fd, take_forced(fd));
+    }
+#else
     int max_fd = 0;
     fd_set rfds, wfds, efds;
     FD_ZERO(&rfds); FD_ZERO(&wfds); FD_ZERO(&efds);
@@ -97,23 +432,6 @@ bool EventManager::handle_next_events(EventMode mode, sigset_t* sigmask, Optiona
             FD_SET(fd, &efds);
     }
 
-    if (m_has_forced_fd)
-        timeout.reset();
-
-    if (not m_timers.empty())
-    {
-        auto next_date = (*std::min_element(
-            m_timers.begin(), m_timers.end(), [](Timer* lhs, Timer* rhs) {
-                return lhs->next_date() < rhs->next_date();
-        }))->next_date();
-
-        if (next_date != TimePoint::max())
-        {
-            auto remaining = std::max(Nanoseconds(0),
-                                      std::chrono::duration_cast<Nanoseconds>(next_date - Clock::now()));
-            timeout = timeout ? std::min(*timeout, remaining) : remaining;
-        }
-    }
     auto ts = timeout.map([](auto nsecs) {
         auto secs = std::chrono::duration_cast<std::chrono::seconds>(nsecs);
         return timespec{(time_t)secs.count(), (long)(nsecs - secs).count()};
@@ -142,12 +460,31 @@ bool EventManager::handle_next_events(EventMode mode, sigset_t* sigmask, Optiona
                 (*it)->run(events, mode);
         }
     }
+#endif
+
+    const TimePoint now = Clock::now();
+    const size_t first_due = m_due_timers.size();
+    OnScopeEnd pop_due{[&] { m_due_timers.resize(first_due); }};
+
+    // due timers form a subtree at the top of the heap
+    if (not m_timers.empty() and m_timers.front()->next_date() <= now)
+        m_due_timers.push_back(m_timers.front());
+    for (size_t i = first_due; i < m_due_timers.size(); ++i)
+    {
+        for (size_t child : {2 * m_due_timers[i]->m_heap_index + 1, 2 * m_due_timers[i]->m_heap_index + 2})
+        {
+            if (child < m_timers.size() and m_timers[child]->next_date() <= now)
+                m_due_timers.push_back(m_timers[child]);
+        }
+    }
+    std::sort(m_due_timers.begin() + first_due, m_due_timers.end(),
+              [](Timer* lhs, Timer* rhs) { return lhs->next_date() < rhs->next_date(); });
 
-    TimePoint now = Clock::now();
-    auto timers = m_timers; // copy timers in case m_timers gets mutated
-    for (auto& timer : timers)
+    // timers destroyed by a previous callback are reset to nullptr, and
+    // callbacks run by nested calls disable their timer
+    for (size_t i = first_due; i < m_due_timers.size(); ++i)
     {
-        if (contains(m_timers, timer) and timer->next_date() <= now)
+        if (Timer* timer = m_due_timers[i]; timer and timer->next_date() <= now)
             timer->run(mode);
     }
 
@@ -167,6 +504,127 @@ void EventManager::handle_urgent_events()
 }
 
 
+UnitTest test_timers{[]{
+    auto& event_manager = EventManager::instance();
+    const TimePoint now = Clock::now();
+    Vector<int> runs;
+    Optional<Timer> later_due;
+    Optional<Timer> added;
+
+    Timer disabled{now - std::chrono::seconds{5}, [&](Timer&) { runs.push_back(-1); }, EventMode::Urgent};
+    disabled.disable();
+    Timer third{now - std::chrono::seconds{1}, [&](Timer&) { runs.push_back(3); }, EventMode::Urgent};
+    Timer first{now - std::chrono::seconds{3}, [&](Timer& timer) {
+        runs.push_back(1);
+        timer.set_next_date(now - std::chrono::seconds{4}); // should not run again in the same dispatch
+        later_due.reset();
+        added.emplace(TimePoint{}, [&](Timer&) { runs.push_back(4); }, EventMode::Urgent);
+    }, EventMode::Urgent};
+    Timer second{now - std::chrono::seconds{2}, [&](Timer&) { runs.push_back(2); }, EventMode::Urgent};
+    later_due.emplace(now - std::chrono::milliseconds{500}, [&](Timer&) { runs.push_back(-2); }, EventMode::Urgent);
+    Timer not_due{now + std::chrono::hours{1}, [&](Timer&) { runs.push_back(-3); }, EventMode::Urgent};
+
+    event_manager.handle_next_events(EventMode::Urgent, nullptr, std::chrono::nanoseconds{});
+    kak_assert((runs == Vector<int>{1, 2, 3}));
+
+    runs.clear();
+    first.disable();
+    event_manager.handle_next_events(EventMode::Urgent, nullptr, std::chrono::nanoseconds{});
+    kak_assert((runs == Vector<int>{4}));
+    kak_assert(added->next_date() == TimePoint::max());
+}};
+
+UnitTest test_fd_watchers{[]{
+    auto& event_manager = EventManager::instance();
+    auto process = [&](std::chrono::nanoseconds timeout = {}) {
+        event_manager.handle_next_events(EventMode::Urgent, nullptr, timeout);
+    };
+
+    int fds[2];
+    kak_assert(pipe(fds) == 0);
+    Vector<int> runs;
+    Optional<FDWatcher> first;
+    first.emplace(fds[0], FdEvents::Read, EventMode::Urgent,
+                  [&](FDWatcher&, FdEvents, EventMode) { runs.push_back(1); });
+    FDWatcher second{fds[0], FdEvents::Read, EventMode::Urgent,
+                     [&](FDWatcher&, FdEvents, EventMode) { runs.push_back(2); }};
+
+    // watchers sharing an fd, the first registered one gets the events
+    kak_assert(write(fds[1], "x", 1) == 1);
+    process();
+    kak_assert((runs == Vector<int>{1}));
+
+    // the data was not read, so the remaining watcher still sees it
+    runs.clear();
+    first.reset();
+    process();
+    kak_assert((runs == Vector<int>{2}));
+
+    runs.clear();
+    event_manager.reset_after_fork();
+    process();
+    kak_assert((runs == Vector<int>{2}));
+
+    char c;
+    kak_assert(read(fds[0], &c, 1) == 1);
+    runs.clear();
+    process();
+    kak_assert(runs.empty());
+
+    // regular files are always ready, and should not make us wait for the timeout
+    const int null_fd = open("/dev/null", O_RDONLY);
+    kak_assert(null_fd != -1);
+    FdEvents null_events = FdEvents::None;
+    {
+        FDWatcher null_watcher{null_fd, FdEvents::Read, EventMode::Urgent,
+                               [&](FDWatcher&, FdEvents events, EventMode) { null_events = events; }};
+        const auto start = Clock::now();
+        process(std::chrono::seconds{1});
+        kak_assert(Clock::now() - start < std::chrono::milliseconds{500});
+        kak_assert(null_events == FdEvents::Read);
+    }
+    null_events = FdEvents::None;
+    process();
+    kak_assert(null_events == FdEvents::None);
+
+    // forced fds run on the next call even if nothing is readable
+    {
+        const auto start = Clock::now();
+        event_manager.force_signal(fds[0]);
+        process(std::chrono::seconds{1});
+        kak_assert(Clock::now() - start < std::chrono::milliseconds{500});
+        kak_assert((runs == Vector<int>{2}));
+    }
+
+#if defined(__linux__)
+    // events consumed by a nested call are not dispatched again
+    {
+        int a[2], b[2];
+        kak_assert(pipe(a) == 0 and pipe(b) == 0);
+        fcntl(a[0], F_SETFL, O_NONBLOCK);
+        fcntl(b[0], F_SETFL, O_NONBLOCK);
+        Vector<int> reads;
+        auto read_and_nest = [&](FDWatcher& watcher, FdEvents, EventMode) {
+            char c;
+            reads.push_back(read(watcher.fd(), &c, 1));
+            if (reads.size() == 1)
+                process();
+        };
+        FDWatcher watcher_a{a[0], FdEvents::Read, EventMode::Urgent, read_and_nest};
+        FDWatcher watcher_b{b[0], FdEvents::Read, EventMode::Urgent, read_and_nest};
+        kak_assert(write(a[1], "x", 1) == 1 and write(b[1], "x", 1) == 1);
+        process();
+        kak_assert((reads == Vector<int>{1, 1}));
+        for (int fd : {a[0], a[1], b[0], b[1]})
+            close(fd);
+    }
+#endif
+
+    close(null_fd);
+    close(fds[0]);
+    close(fds[1]);
+}};
+
 SignalHandler set_signal_handler(int signum, SignalHandler handler)
 {
     struct sigaction new_action, old_action;
@@ -41,14 +41,14 @@ public:
 
     int fd() const { return m_fd; }
     FdEvents events() const { return m_events; }
-    FdEvents& events() { return m_events; }
+    void set_events(FdEvents events);
     EventMode mode() const { return m_mode; }
 
     void run(FdEvents events, EventMode mode);
 
-    void reset_fd(int fd) { m_fd = fd; }
+    void reset_fd(int fd);
     void close_fd();
-    void disable() { m_fd = -1; }
+    void disable() { reset_fd(-1); }
 
 private:
     int      m_fd;
@@ -69,14 +69,18 @@ public:
     ~Timer();
 
     TimePoint next_date() const { return m_date; }
-    void set_next_date(TimePoint date) { m_date = date; }
-    void disable() { m_date = TimePoint::max(); }
+    void set_next_date(TimePoint date);
+    void disable() { set_next_date(TimePoint::max()); }
     void run(EventMode mode);
 
 private:
+    friend class EventManager;
+    static constexpr size_t unregistered = (size_t)-1;
+
     TimePoint m_date;
     EventMode m_mode;
     Callback  m_callback;
+    size_t    m_heap_index = unregistered;
 };
 
 // The EventManager provides an interface to file descriptor
@@ -102,15 +106,46 @@ public:
 
     static void handle_urgent_events();
 
+    // to be called in a forked process that keeps using the event manager,
+    // so that it does not share its kernel side state with its parent.
+    void reset_after_fork();
+
 private:
     friend class FDWatcher;
     friend class Timer;
+
+    void register_watcher(FDWatcher& watcher);
+    void unregister_watcher(FDWatcher& watcher, int fd);
+    void update_watcher(FDWatcher& watcher, int old_fd);
+
+    void register_timer(Timer& timer);
+    void unregister_timer(Timer& timer);
+    void sift_timer(size_t index);
+
     Vector<FDWatcher*, MemoryDomain::Events> m_fd_watchers;
+    // binary min heap on next date
     Vector<Timer*, MemoryDomain::Events>     m_timers;
+    // timers being dispatched, nested dispatches append to it
+    Vector<Timer*, MemoryDomain::Events>     m_due_timers;
     fd_set m_forced_fd;
     bool   m_has_forced_fd = false;
 
-    TimePoint m_last;
+#if defined(__linux__)
+    void open_epoll();
+    void close_epoll();
+    void epoll_add(FDWatcher& watcher);
+    void epoll_remove(FDWatcher& watcher, int fd);
+
+    // all watched fds, and only the urgent ones
+    int m_epoll_fd = -1;
+    int m_urgent_epoll_fd = -1;
+    // watcher registered in epoll for a given fd
+    Vector<FDWatcher*, MemoryDomain::Events> m_watcher_by_fd;
+    // watchers on fds that epoll does not support (regular files), always ready
+    Vector<FDWatcher*, MemoryDomain::Events> m_always_ready_watchers;
+    // number of epoll waits, to detect the ones nested in callbacks
+    size_t m_wait_count = 0;
+#endif
 };
 
 using SignalHandler = void(*)(int);
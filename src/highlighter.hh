@@ -45,6 +45,8 @@ struct DisplaySetup
     ColumnCount widget_columns{};
     // Offset of line and columns that must remain visible around cursor
     DisplayCoord scroll_offset{};
+    // Long lines must be given whole to highlighters instead of their visible part
+    bool full_lines{};
 };
 
 using HighlighterIdList = ConstArrayView<StringView>;
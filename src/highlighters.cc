@@ -167,6 +167,54 @@ private:
     ValueId m_id;
 };
 
+// Buffer ranges covered by the display buffer lines, merged when contiguous. Lines up
+// to margin bytes long are taken whole, longer ones are only taken around their
+// displayed part so that searching them does not depend on their full length.
+static Vector<BufferRange, MemoryDomain::Highlight>
+displayed_ranges(const Buffer& buffer, const DisplayBuffer& display_buffer, ByteCount margin)
+{
+    auto line_end = [&](LineCount line) { return BufferCoord{line, buffer[line].length()}; };
+
+    Vector<BufferRange, MemoryDomain::Highlight> ranges;
+    for (auto& line : display_buffer.lines())
+    {
+        BufferRange range = line.range();
+        if (range.end < range.begin or range.begin.line >= buffer.line_count())
+            continue;
+
+        const LineCount l = range.begin.line;
+        const StringView content = buffer[l];
+        if (margin > 0 and content.length() > margin)
+        {
+            ByteCount begin = std::max(0_byte, range.begin.column - margin);
+            while (begin > 0 and not utf8::is_character_start(content[begin]))
+                --begin;
+            range.begin.column = begin;
+            if (range.end.line == l)
+            {
+                ByteCount end = std::min(content.length(), range.end.column + margin);
+                while (end < content.length() and not utf8::is_character_start(content[end]))
+                    ++end;
+                range.end.column = end;
+            }
+        }
+        else
+            range = {l, std::max(range.end, line_end(l))};
+
+        if (range.end.column == 0 and range.end.line > 0)
+            range.end = line_end(range.end.line - 1);
+
+        if (not ranges.empty() and
+            (range.begin <= ranges.back().end or
+             (ranges.back().end == line_end(ranges.back().end.line) and
+              range.begin == BufferCoord{ranges.back().end.line + 1, 0})))
+            ranges.back().end = std::max(ranges.back().end, range.end);
+        else
+            ranges.push_back(range);
+    }
+    return ranges;
+}
+
 using FacesSpec = Vector<std::pair<size_t, FaceSpec>, MemoryDomain::Highlight>;
 
 const HighlighterDesc regex_desc = {
@@ -199,17 +247,22 @@ public:
                 return faces[spec.second];
             }) | gather<Vector<Face>>();
 
-        const auto& matches = get_matches(context.context.buffer(), display_buffer.range(), range);
-        kak_assert(matches.size() % m_faces.size() == 0);
-        for (size_t m = 0; m < matches.size(); ++m)
+        const auto& buffer = context.context.buffer();
+        const ByteCount margin = context.context.options()["long_line_margin"].get<int>();
+        for (auto& display_range : displayed_ranges(buffer, display_buffer, margin))
         {
-            auto& face = faces[m % faces.size()];
-            if (face == Face{})
-                continue;
+            const auto& matches = get_matches(buffer, display_range, range, margin);
+            kak_assert(matches.size() % m_faces.size() == 0);
+            for (size_t m = 0; m < matches.size(); ++m)
+            {
+                auto& face = faces[m % faces.size()];
+                if (face == Face{})
+                    continue;
 
-            highlight_range(display_buffer,
-                            matches[m].begin, matches[m].end,
-                            false, apply_face(face));
+                highlight_range(display_buffer,
+                                matches[m].begin, matches[m].end,
+                                false, apply_face(face));
+            }
         }
     }
 
@@ -250,6 +303,10 @@ public:
 private:
     // stores the range for each highlighted capture of each match
     using MatchList = Vector<BufferRange, MemoryDomain::Highlight>;
+    // Number of stored capture ranges, of 16 bytes each, above which the cache
+    // is cleared. The former 1000 was sized for the displayed screen, this
+    // leaves room for the screens prefetched above and below it when idle.
+    static constexpr size_t max_cached_match_ranges = 4000;
     struct Cache
     {
         size_t m_timestamp = -1;
@@ -295,13 +352,13 @@ private:
         }
     }
 
-    const MatchList& get_matches(const Buffer& buffer, BufferRange display_range, BufferRange buffer_range)
+    const MatchList& get_matches(const Buffer& buffer, BufferRange display_range, BufferRange buffer_range, ByteCount margin)
     {
         Cache& cache = m_cache.get(buffer);
 
         if (cache.m_regex_version != m_regex_version or
             cache.m_timestamp != buffer.timestamp() or
-            accumulate(cache.m_matches, (size_t)0, [](size_t c, auto&& m) { return c + m.value.size(); }) > 1000)
+            accumulate(cache.m_matches, (size_t)0, [](size_t c, auto&& m) { return c + m.value.size(); }) > max_cached_match_ranges)
         {
             cache.m_matches.clear();
             cache.m_timestamp = buffer.timestamp();
@@ -310,9 +367,42 @@ private:
 
         auto& matches = cache.m_matches[buffer_range];
 
+        // Search a few lines around the displayed ones, unless they are long lines that were cut,
+        // and only take the margin of the long lines found there
         const LineCount line_offset = 3;
-        BufferRange range{std::max<BufferCoord>(buffer_range.begin, display_range.begin.line - line_offset),
-                          std::min<BufferCoord>(buffer_range.end, display_range.end.line + line_offset)};
+        auto is_long = [&](LineCount line) { return margin > 0 and buffer[line].length() > margin; };
+        auto search_begin = [&]() -> BufferCoord {
+            if (display_range.begin.column != 0)
+                return display_range.begin;
+            for (LineCount line = display_range.begin.line - 1; line >= 0 and line >= display_range.begin.line - line_offset; --line)
+            {
+                if (not is_long(line))
+                    continue;
+                const StringView content = buffer[line];
+                ByteCount begin = content.length() - margin;
+                while (begin < content.length() and not utf8::is_character_start(content[begin]))
+                    ++begin;
+                return {line, begin};
+            }
+            return display_range.begin.line - line_offset;
+        };
+        auto search_end = [&]() -> BufferCoord {
+            if (display_range.end.column != buffer[display_range.end.line].length())
+                return display_range.end;
+            for (LineCount line = display_range.end.line + 1; line < buffer.line_count() and line < display_range.end.line + line_offset; ++line)
+            {
+                if (not is_long(line))
+                    continue;
+                const StringView content = buffer[line];
+                ByteCount end = margin;
+                while (end < content.length() and not utf8::is_character_start(content[end]))
+                    ++end;
+                return {line, end};
+            }
+            return display_range.end.line + line_offset;
+        };
+        BufferRange range{std::max<BufferCoord>(buffer_range.begin, search_begin()),
+                          std::min<BufferCoord>(buffer_range.end, search_end())};
 
         auto it = std::upper_bound(matches.begin(), matches.end(), range.begin,
                                    [](const BufferCoord& lhs, const Cache::RangeAndMatches& rhs)
@@ -632,6 +722,11 @@ struct WrapHighlighter : Highlighter
         const int tabstop = context.context.options()["tabstop"].get<int>();
         const ColumnCount marker_len = zero_if_greater(m_marker.column_length(), wrap_column);
         const Face face_marker = context.context.faces()["WrapMarker"];
+        const BufferCoord cursor = context.context.selections().main().cursor();
+        const bool cursor_visible = context.context.ensure_cursor_visible;
+        const size_t max_rows = (size_t)(int)context.context.window().dimensions().line;
+
+        Cache& cache = get_cache(buffer, wrap_column, marker_len, tabstop);
         for (auto it = display_buffer.lines().begin();
              it != display_buffer.lines().end(); ++it)
         {
@@ -639,6 +734,38 @@ struct WrapHighlighter : Highlighter
                 zero_if_greater(line_indent(buffer, tabstop, it->range().begin.line), wrap_column) : 0_col;
             const ColumnCount prefix_len = std::max(marker_len, indent);
 
+            if (is_whole_line(buffer, *it))
+            {
+                // Only materialize the rows that can end up on screen, a line before the cursor
+                // line can only show its last rows, the cursor line the ones around the cursor.
+                const LineCount line = it->range().begin.line;
+                LineWrap& wrap = get_line_wrap(cache, line);
+                size_t first_row = 0, end_row = 0;
+                if (cursor_visible and line < cursor.line)
+                {
+                    extend_line_wrap(buffer, wrap, wrap_column, prefix_len, [](auto&) { return false; });
+                    end_row = wrap.splits.size() + 1;
+                    first_row = end_row > max_rows ? end_row - max_rows : 0;
+                }
+                else if (cursor_visible and line == cursor.line)
+                {
+                    extend_line_wrap(buffer, wrap, wrap_column, prefix_len,
+                                     [&](auto& splits) { return not splits.empty() and splits.back() > cursor.column; });
+                    const size_t cursor_row = std::upper_bound(wrap.splits.begin(), wrap.splits.end(), cursor.column) - wrap.splits.begin();
+                    first_row = cursor_row >= max_rows ? cursor_row - max_rows + 1 : 0;
+                    end_row = cursor_row + max_rows;
+                }
+                else
+                    end_row = max_rows;
+
+                extend_line_wrap(buffer, wrap, wrap_column, prefix_len,
+                                 [&](auto& splits) { return splits.size() >= end_row; });
+                end_row = std::min(end_row, wrap.splits.size() + 1);
+                it = wrap_line_from_index(display_buffer.lines(), it, wrap, first_row, end_row,
+                                          marker_len, indent, face_marker);
+                continue;
+            }
+
             SplitPos pos{it->begin(), 0, 0}; ;
             while (next_split_pos(pos, it->end(), wrap_column, prefix_len))
             {
@@ -679,6 +806,7 @@ struct WrapHighlighter : Highlighter
         // Disable horizontal scrolling when using a WrapHighlighter
         setup.first_column = 0;
         setup.scroll_offset.column = 0;
+        setup.full_lines = true;
     }
 
     void fill_unique_ids(Vector<StringView>& unique_ids) const override
@@ -769,6 +897,149 @@ struct WrapHighlighter : Highlighter
         return true;
     }
 
+    // Byte offsets at which each row but the first of a buffer line begins, computed
+    // lazily as rows are requested and reused until that line gets modified.
+    struct LineWrap
+    {
+        LineCount line;
+        Vector<ByteCount, MemoryDomain::Highlight> splits;
+        bool complete = false;
+    };
+
+    // Split points depend on the layout, windows of different widths showing
+    // the same buffer each get their own cache
+    struct Cache
+    {
+        size_t buffer_timestamp = 0;
+        ColumnCount wrap_column = -1;
+        ColumnCount marker_len = -1;
+        int tabstop = -1;
+        Vector<LineWrap, MemoryDomain::Highlight> lines;
+    };
+    using Caches = Vector<Cache, MemoryDomain::Highlight>;
+
+    // A few screens worth of lines, the cache is refilled from the displayed
+    // lines once it grows past it after scrolling through a long buffer
+    static constexpr size_t max_cached_lines = 1000;
+    // Different layouts for a buffer usually come from a few split windows
+    static constexpr size_t max_cached_layouts = 4;
+
+    Cache& get_cache(const Buffer& buffer, ColumnCount wrap_column, ColumnCount marker_len, int tabstop)
+    {
+        Caches& caches = m_cache.get(buffer);
+        auto it = find_if(caches, [&](const Cache& c) {
+            return c.wrap_column == wrap_column and c.marker_len == marker_len and c.tabstop == tabstop;
+        });
+        if (it == caches.end())
+        {
+            if (caches.size() >= max_cached_layouts)
+                caches.erase(caches.begin());
+            caches.push_back({buffer.timestamp(), wrap_column, marker_len, tabstop, {}});
+            it = caches.end() - 1;
+        }
+        else // keep the most recently used layouts at the end
+            it = std::rotate(it, it + 1, caches.end());
+
+        Cache& cache = *it;
+        if (cache.lines.size() > max_cached_lines)
+        {
+            cache.lines.clear();
+            cache.buffer_timestamp = buffer.timestamp();
+        }
+        else if (cache.buffer_timestamp != buffer.timestamp())
+        {
+            auto modifs = compute_line_modifications(buffer, cache.buffer_timestamp);
+            auto ins_pos = cache.lines.begin();
+            for (auto it = cache.lines.begin(); it != cache.lines.end(); ++it)
+            {
+                auto modif_it = std::upper_bound(modifs.begin(), modifs.end(), it->line,
+                                                 [](const LineCount& l, const LineModification& c)
+                                                 { return l < c.old_line; });
+                if (modif_it != modifs.begin())
+                {
+                    auto& prev = *(modif_it-1);
+                    if (it->line < prev.old_line + prev.num_removed)
+                        continue; // line modified or removed
+
+                    it->line += prev.diff();
+                }
+
+                if (ins_pos != it)
+                    *ins_pos = std::move(*it);
+                ++ins_pos;
+            }
+            cache.lines.erase(ins_pos, cache.lines.end());
+            cache.buffer_timestamp = buffer.timestamp();
+        }
+        return cache;
+    }
+
+    static LineWrap& get_line_wrap(Cache& cache, LineCount line)
+    {
+        auto it = std::lower_bound(cache.lines.begin(), cache.lines.end(), line,
+                                   [](const LineWrap& wrap, LineCount line) { return wrap.line < line; });
+        if (it == cache.lines.end() or it->line != line)
+            it = cache.lines.insert(it, LineWrap{line, {}});
+        return *it;
+    }
+
+    static bool is_whole_line(const Buffer& buffer, const DisplayLine& line)
+    {
+        if (line.atoms().size() != 1)
+            return false;
+        auto& atom = line.atoms().front();
+        const LineCount l = line.range().begin.line;
+        return atom.type() == DisplayAtom::Range and
+               atom.begin() == BufferCoord{l, 0} and atom.end() == BufferCoord{l, buffer[l].length()};
+    }
+
+    template<typename Done>
+    void extend_line_wrap(const Buffer& buffer, LineWrap& wrap, ColumnCount wrap_column,
+                          ColumnCount prefix_len, Done done) const
+    {
+        const ByteCount line_length = buffer[wrap.line].length();
+        while (not wrap.complete and not done(wrap.splits))
+        {
+            const ByteCount start = wrap.splits.empty() ? 0 : wrap.splits.back();
+            DisplayLine row{AtomList{{buffer, {{wrap.line, start}, {wrap.line, line_length}}}}};
+            SplitPos pos{row.begin(), 0, wrap.splits.empty() ? 0_col : prefix_len};
+            if (not next_split_pos(pos, row.end(), wrap_column, prefix_len) or pos.byte == 0)
+                wrap.complete = true;
+            else
+                wrap.splits.push_back(start + pos.byte);
+        }
+    }
+
+    DisplayLineList::iterator wrap_line_from_index(DisplayLineList& lines, DisplayLineList::iterator it,
+                                                   const LineWrap& wrap, size_t first_row, size_t end_row,
+                                                   ColumnCount marker_len, ColumnCount indent, Face face_marker) const
+    {
+        const DisplayAtom& atom = it->atoms().front();
+        const Buffer& buffer = atom.buffer();
+        const LineCount line = wrap.line;
+        const BufferCoord line_end = atom.end();
+        const Face face = atom.face;
+
+        DisplayLineList rows;
+        for (size_t row = first_row; row < end_row; ++row)
+        {
+            const BufferCoord begin{line, row == 0 ? 0 : wrap.splits[row-1]};
+            const BufferCoord end = row < wrap.splits.size() ? BufferCoord{line, wrap.splits[row]} : line_end;
+            AtomList atoms;
+            if (row != 0 and marker_len != 0)
+                atoms.push_back({m_marker, face_marker});
+            if (row != 0 and indent > marker_len)
+                atoms.push_back({buffer, {begin, begin}, String{' ', indent - marker_len}});
+            atoms.push_back({buffer, {begin, end}, face});
+            rows.emplace_back(std::move(atoms));
+        }
+
+        const size_t index = it - lines.begin();
+        lines.insert(it+1, std::make_move_iterator(rows.begin()+1), std::make_move_iterator(rows.end()));
+        lines[index] = std::move(rows.front());
+        return lines.begin() + index + rows.size() - 1;
+    }
+
     static ColumnCount line_indent(const Buffer& buffer, int tabstop, LineCount line)
     {
         StringView l = buffer[line];
@@ -795,6 +1066,8 @@ struct WrapHighlighter : Highlighter
     const bool m_preserve_indent;
     const ColumnCount m_max_width;
     const String m_marker;
+
+    BufferSideCache<Caches> m_cache;
 };
 
 struct TabulationHighlighter : Highlighter
@@ -1269,6 +1542,54 @@ void expand_unprintable(HighlightContext context, DisplayBuffer& display_buffer,
     }
 }
 
+// Spec lists are kept sorted, merge added elements instead of sorting
+// everything again, and look for removed ones with a binary search
+template<typename T, typename Compare>
+static bool add_sorted_from_strings(Vector<T, MemoryDomain::Options>& opt, ConstArrayView<String> strs,
+                                    Compare compare)
+{
+    auto vec = option_from_strings(Meta::Type<Vector<T, MemoryDomain::Options>>{}, strs);
+    if (vec.empty())
+        return false;
+    auto middle = opt.insert(opt.end(),
+                             std::make_move_iterator(vec.begin()),
+                             std::make_move_iterator(vec.end()));
+    std::sort(middle, opt.end(), compare);
+    std::inplace_merge(opt.begin(), middle, opt.end(), compare);
+    return true;
+}
+
+template<typename T, typename Compare>
+static bool remove_sorted_from_strings(Vector<T, MemoryDomain::Options>& opt, ConstArrayView<String> strs,
+                                       Compare compare)
+{
+    Vector<bool, MemoryDomain::Options> removed(opt.size(), false);
+    bool did_remove = false;
+    for (auto&& val : strs | transform([](auto&& s) { return option_from_string(Meta::Type<T>{}, s); }))
+    {
+        auto [begin, end] = std::equal_range(opt.begin(), opt.end(), val, compare);
+        auto it = std::find_if(begin, end, [&](const T& elem) { return not removed[&elem - opt.data()] and elem == val; });
+        if (it == end)
+            continue;
+        removed[it - opt.begin()] = true;
+        did_remove = true;
+    }
+    if (not did_remove)
+        return false;
+
+    auto ins_pos = opt.begin();
+    for (auto it = opt.begin(); it != opt.end(); ++it)
+    {
+        if (removed[it - opt.begin()])
+            continue;
+        if (ins_pos != it)
+            *ins_pos = std::move(*it);
+        ++ins_pos;
+    }
+    opt.erase(ins_pos, opt.end());
+    return true;
+}
+
 static void update_line_specs_ifn(const Buffer& buffer, LineAndSpecList& line_flags)
 {
     if (line_flags.prefix == buffer.timestamp())
@@ -1277,13 +1598,14 @@ static void update_line_specs_ifn(const Buffer& buffer, LineAndSpecList& line_fl
     auto& lines = line_flags.list;
 
     auto modifs = compute_line_modifications(buffer, line_flags.prefix);
+    // both lines and modifications are sorted, walk them together
+    auto modif_it = modifs.begin();
     auto ins_pos = lines.begin();
     for (auto it = lines.begin(); it != lines.end(); ++it)
     {
         auto& line = std::get<0>(*it); // that line is 1 based as it comes from user side
-        auto modif_it = std::upper_bound(modifs.begin(), modifs.end(), line-1,
-                                         [](const LineCount& l, const LineModification& c)
-                                         { return l < c.old_line; });
+        while (modif_it != modifs.end() and modif_it->old_line <= line-1)
+            ++modif_it;
         if (modif_it != modifs.begin())
         {
             auto& prev = *(modif_it-1);
@@ -1306,11 +1628,24 @@ void option_update(LineAndSpecList& opt, const Context& context)
     update_line_specs_ifn(context.buffer(), opt);
 }
 
+static bool line_spec_compare(const LineAndSpec& lhs, const LineAndSpec& rhs)
+{
+    return std::get<0>(lhs) < std::get<0>(rhs);
+}
+
 void option_list_postprocess(Vector<LineAndSpec, MemoryDomain::Options>& opt)
 {
-    std::sort(opt.begin(), opt.end(),
-              [](auto& lhs, auto& rhs)
-              { return std::get<0>(lhs) < std::get<0>(rhs); });
+    std::sort(opt.begin(), opt.end(), line_spec_compare);
+}
+
+bool option_add_from_strings(Vector<LineAndSpec, MemoryDomain::Options>& opt, ConstArrayView<String> strs)
+{
+    return add_sorted_from_strings(opt, strs, line_spec_compare);
+}
+
+bool option_remove_from_strings(Vector<LineAndSpec, MemoryDomain::Options>& opt, ConstArrayView<String> strs)
+{
+    return remove_sorted_from_strings(opt, strs, line_spec_compare);
 }
 
 const HighlighterDesc flag_lines_desc = {
@@ -1374,9 +1709,11 @@ private:
         for (auto& line : display_buffer.lines())
         {
             int line_num = (int)line.range().begin.line + 1;
-            auto it = find_if(lines,
-                              [&](const LineAndSpec& l)
-                              { return std::get<0>(l) == line_num; });
+            auto it = std::lower_bound(lines.begin(), lines.end(), line_num,
+                                       [](const LineAndSpec& l, int line_num)
+                                       { return std::get<0>(l) < line_num; });
+            if (it != lines.end() and std::get<0>(*it) != line_num)
+                it = lines.end();
             if (m_after)
             {
                 if (it != lines.end())
@@ -1500,6 +1837,8 @@ struct OptionBasedHighlighter : Highlighter
         return context.context.options()[m_option_name].template get_mutable<OptionType>();
     }
 
+    const String& option_name() const { return m_option_name; }
+
 private:
     const String m_option_name;
 };
@@ -1527,17 +1866,109 @@ void option_update(RangeAndStringList& opt, const Context& context)
 
 bool option_add_from_strings(Vector<RangeAndString, MemoryDomain::Options>& opt, ConstArrayView<String> strs)
 {
-    auto vec = option_from_strings(Meta::Type<Vector<RangeAndString, MemoryDomain::Options>>{}, strs);
-    if (vec.empty())
-        return false;
-    auto middle = opt.insert(opt.end(),
-                             std::make_move_iterator(vec.begin()),
-                             std::make_move_iterator(vec.end()));
-    std::sort(middle, opt.end(), option_element_compare);
-    std::inplace_merge(opt.begin(), middle, opt.end(), option_element_compare);
-    return true;
+    return add_sorted_from_strings(opt, strs, option_element_compare);
+}
+
+bool option_remove_from_strings(Vector<RangeAndString, MemoryDomain::Options>& opt, ConstArrayView<String> strs)
+{
+    return remove_sorted_from_strings(opt, strs, option_element_compare);
 }
 
+// Coordinate before the given changes of a coordinate after them. Inserted text maps
+// to its insertion point, and the end of an erased text to its lowest or highest
+// coordinate before erasure.
+static BufferCoord coord_before_changes(ConstArrayView<Buffer::Change> changes, BufferCoord coord, bool lowest)
+{
+    for (auto& change : changes | reverse())
+    {
+        if (coord < change.begin)
+            continue;
+
+        if (change.type == Buffer::Change::Insert)
+        {
+            if (coord < change.end)
+            {
+                coord = change.begin;
+                continue;
+            }
+            if (coord.line == change.end.line)
+                coord.column += change.begin.column - change.end.column;
+            coord.line -= change.end.line - change.begin.line;
+        }
+        else if (coord != change.begin or not lowest)
+        {
+            if (coord.line == change.begin.line)
+                coord.column += change.end.column - change.begin.column;
+            coord.line += change.end.line - change.begin.line;
+        }
+    }
+    return coord;
+}
+
+struct RangeSpec
+{
+    InclusiveBufferRange range;
+    StringView spec;
+};
+
+BufferCoord& get_first(RangeSpec& r) { return r.range.first; }
+BufferCoord& get_last(RangeSpec& r) { return r.range.last; }
+
+// The range highlighters leave range-specs in the coordinates of their timestamp,
+// and only move the ones overlapping the displayed lines to the current buffer
+// coordinates, so that a buffer modification does not need a pass over all of
+// them. As ranges are sorted by their start, the ones overlapping a given range
+// are found by binary searching the maximum end of the ranges up to each one.
+struct RangeSpecsIndex
+{
+    Vector<RangeSpec, MemoryDomain::Highlight> overlapping(const Context& context, StringView option_name,
+                                                           BufferRange range)
+    {
+        auto& buffer = context.buffer();
+        auto& option = context.options()[option_name];
+        auto* ranges = &option.get<RangeAndStringList>();
+
+        // Past some amount of changes, moving the ranges once is cheaper
+        constexpr size_t max_pending_changes = 64;
+        if (ranges->prefix != buffer.timestamp() and
+            buffer.changes_since(ranges->prefix).size() > max_pending_changes)
+            option.update(context);
+
+        if (m_option_version != option.version())
+        {
+            m_option_version = option.version();
+            m_max_ends.clear();
+            m_max_ends.reserve(ranges->list.size());
+            BufferCoord max_end{};
+            for (auto& [r, spec] : ranges->list)
+                m_max_ends.push_back(max_end = std::max(max_end, is_empty(r) ? r.first : r.last));
+        }
+
+        auto& list = ranges->list;
+        auto changes = buffer.changes_since(ranges->prefix);
+        const BufferCoord begin = coord_before_changes(changes, range.begin, true);
+        const BufferCoord end = coord_before_changes(changes, range.end, false);
+
+        auto first = list.begin() + (std::lower_bound(m_max_ends.begin(), m_max_ends.end(), begin) - m_max_ends.begin());
+        auto last = std::upper_bound(first, list.end(), end, [](const BufferCoord& coord, const RangeAndString& r)
+                                     { return coord < std::get<0>(r).first; });
+
+        Vector<RangeSpec, MemoryDomain::Highlight> res;
+        for (auto it = first; it != last; ++it)
+        {
+            auto& [r, spec] = *it;
+            if ((is_empty(r) ? r.first : r.last) >= begin)
+                res.push_back({r, spec});
+        }
+        update_ranges(buffer, ranges->prefix, res);
+        return res;
+    }
+
+private:
+    size_t m_option_version = -1;
+    Vector<BufferCoord, MemoryDomain::Highlight> m_max_ends;
+};
+
 const HighlighterDesc ranges_desc = {
     "Parameters: <option name>\n"
     "Use the range-specs option given as parameter to highlight buffer\n"
@@ -1551,12 +1982,11 @@ private:
     void do_highlight(HighlightContext context, DisplayBuffer& display_buffer, BufferRange) override
     {
         auto& buffer = context.context.buffer();
-        auto& range_and_faces = get_option(context);
-        update_ranges(buffer, range_and_faces.prefix, range_and_faces.list);
-        range_and_faces.prefix = buffer.timestamp();
-
-        for (auto& [range, face] : range_and_faces.list)
+        const auto display_range = display_buffer.range();
+        for (auto& [range, face] : m_index.get(buffer).overlapping(context.context, option_name(), display_range))
         {
+            if (range.last < display_range.begin or range.first > display_range.end)
+                continue;
             try
             {
                 if (buffer.is_valid(range.first) and (buffer.is_valid(range.last) and not buffer.is_end(range.last)))
@@ -1567,6 +1997,8 @@ private:
             {}
         }
     }
+
+    BufferSideCache<RangeSpecsIndex> m_index;
 };
 
 const HighlighterDesc replace_ranges_desc = {
@@ -1596,12 +2028,11 @@ private:
     {
         auto& buffer = context.context.buffer();
         auto& sels = context.context.selections();
-        auto& range_and_faces = get_option(context);
-        update_ranges(buffer, range_and_faces.prefix, range_and_faces.list);
-        range_and_faces.prefix = buffer.timestamp();
-
-        for (auto& [range, spec] : range_and_faces.list)
+        const auto display_range = display_buffer.range();
+        for (auto& [range, spec] : m_index.get(buffer).overlapping(context.context, option_name(), display_range))
         {
+            if (range.first > display_range.end)
+                continue;
             try
             {
                 if (not is_valid(buffer, range.first) or (not is_empty(range) and not is_valid(buffer, range.last)) or not is_fully_selected(sels, range))
@@ -1637,29 +2068,41 @@ private:
     {
         auto& buffer = context.context.buffer();
         auto& sels = context.context.selections();
-        auto& range_and_faces = get_option(context);
-        update_ranges(buffer, range_and_faces.prefix, range_and_faces.list);
-        range_and_faces.prefix = buffer.timestamp();
 
-        for (auto& [range, spec] : range_and_faces.list)
+        // Replacements can grow the line count, and bring the ranges on the following lines in the setup
+        for (LineCount begin_line = -1, end_line = setup.first_line + setup.line_count;
+             begin_line < end_line;
+             begin_line = end_line, end_line = setup.first_line + setup.line_count)
         {
-            if (not is_valid(buffer, range.first) or (not is_empty(range) and not is_valid(buffer, range.last)) or not is_fully_selected(sels, range))
-                continue;
+            // ranges ending at the end of the line before can still be replaced up to the first line
+            const BufferRange query{{std::max(begin_line, setup.first_line - 1), 0}, {end_line + 1, 0}};
+            for (auto& [range, spec] : m_index.get(buffer).overlapping(context.context, option_name(), query))
+            {
+                // ranges are sorted, the following ones cannot affect the setup
+                if (range.first.line > setup.first_line + setup.line_count)
+                    break;
 
-            auto last = is_empty(range) ? range.first : buffer.char_next(range.last);
-            if (range.first.line < setup.first_line and last.line >= setup.first_line)
-                setup.first_line = range.first.line;
+                if (range.first.line <= begin_line or not is_valid(buffer, range.first) or
+                    (not is_empty(range) and not is_valid(buffer, range.last)) or not is_fully_selected(sels, range))
+                    continue;
 
-            if (last.line >= setup.first_line and
-                range.first.line <= setup.first_line + setup.line_count and
-                range.first.line != last.line)
-            {
-                auto added_count = std::count(spec.begin(), spec.end(), '\n');
-                auto removed_count = last.line - range.first.line;
-                setup.line_count += removed_count - added_count;
+                auto last = is_empty(range) ? range.first : buffer.char_next(range.last);
+                if (range.first.line < setup.first_line and last.line >= setup.first_line)
+                    setup.first_line = range.first.line;
+
+                if (last.line >= setup.first_line and
+                    range.first.line <= setup.first_line + setup.line_count and
+                    range.first.line != last.line)
+                {
+                    auto added_count = std::count(spec.begin(), spec.end(), '\n');
+                    auto removed_count = last.line - range.first.line;
+                    setup.line_count += removed_count - added_count;
+                }
             }
         }
     }
+
+    mutable BufferSideCache<RangeSpecsIndex> m_index;
 };
 
 HighlightPass parse_passes(StringView str)
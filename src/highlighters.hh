@@ -28,6 +28,8 @@ constexpr StringView option_type_name(Meta::Type<LineAndSpecList>)
 }
 void option_update(LineAndSpecList& opt, const Context& context);
 void option_list_postprocess(Vector<LineAndSpec, MemoryDomain::Options>& opt);
+bool option_add_from_strings(Vector<LineAndSpec, MemoryDomain::Options>& opt, ConstArrayView<String> strs);
+bool option_remove_from_strings(Vector<LineAndSpec, MemoryDomain::Options>& opt, ConstArrayView<String> strs);
 
 using RangeAndString = std::tuple<InclusiveBufferRange, String>;
 using RangeAndStringList = TimestampedList<RangeAndString>;
@@ -39,6 +41,7 @@ constexpr StringView option_type_name(Meta::Type<RangeAndStringList>)
 void option_update(RangeAndStringList& opt, const Context& context);
 void option_list_postprocess(Vector<RangeAndString, MemoryDomain::Options>& opt);
 bool option_add_from_strings(Vector<RangeAndString, MemoryDomain::Options>& opt, ConstArrayView<String> strs);
+bool option_remove_from_strings(Vector<RangeAndString, MemoryDomain::Options>& opt, ConstArrayView<String> strs);
 
 }
 
@@ -10,16 +10,90 @@
 #include "profile.hh"
 #include "ranges.hh"
 #include "regex.hh"
+#include "unit_tests.hh"
 
 namespace Kakoune
 {
 
+enum class FilterKind
+{
+    MatchAll,
+    Literal,
+    Alternation,
+    Regex
+};
+
+static StringView filter_kind_name(FilterKind kind)
+{
+    constexpr StringView names[] = { "match-all", "literal", "alternation", "regex" };
+    return names[to_underlying(kind)];
+}
+
+struct FilterClass
+{
+    FilterKind kind;
+    Vector<String, MemoryDomain::Hooks> literals;
+};
+
+// Detects filters that match any parameter, or only a fixed set of literal
+// parameters, which do not need to run the regex to know if they match
+static FilterClass classify_filter(StringView filter)
+{
+    if (filter == ".*")
+        return {FilterKind::MatchAll, {}};
+
+    Vector<String, MemoryDomain::Hooks> literals{String{}};
+    for (auto it = filter.begin(), end = filter.end(); it != end; ++it)
+    {
+        char c = *it;
+        if (c == '|')
+        {
+            literals.emplace_back();
+            continue;
+        }
+        if (c == '\\')
+        {
+            if (++it == end or not contains(StringView{"^$\\.*+?()[]{}|"}, *it))
+                return {FilterKind::Regex, {}};
+            c = *it;
+        }
+        else if (contains(StringView{"^$.*+?()[]{}"}, c))
+            return {FilterKind::Regex, {}};
+        literals.back().push_back(c);
+    }
+
+    std::sort(literals.begin(), literals.end());
+    literals.erase(std::unique(literals.begin(), literals.end()), literals.end());
+    return {literals.size() == 1 ? FilterKind::Literal : FilterKind::Alternation, std::move(literals)};
+}
+
 struct HookManager::HookData
 {
     String group;
     HookFlags flags;
     Regex filter;
     String commands;
+    size_t order;
+    FilterClass filter_class = classify_filter(filter.str());
+    size_t match_count = 0;
+
+    bool matches(StringView param, MatchResults<const char*>& captures) const
+    {
+        switch (filter_class.kind)
+        {
+            case FilterKind::Literal:
+            case FilterKind::Alternation:
+                if (not contains(filter_class.literals, param))
+                    return false;
+                [[fallthrough]];
+            case FilterKind::MatchAll:
+                captures = MatchResults<const char*>{{param.begin(), param.end()}};
+                return true;
+            case FilterKind::Regex:
+                return regex_match(param.begin(), param.end(), captures, filter);
+        }
+        return false;
+    }
 
     bool should_run(bool only_always, const Regex& disabled_hooks, StringView param,
                     MatchResults<const char*>& captures) const
@@ -27,7 +101,7 @@ struct HookManager::HookData
         return (not only_always or (flags & HookFlags::Always)) and
                 (group.empty() or disabled_hooks.empty() or
                  not regex_match(group.begin(), group.end(), disabled_hooks))
-                and regex_match(param.begin(), param.end(), captures, filter);
+                and matches(param, captures);
     }
 
     void exec(Hook hook, StringView param, Context& context, const MatchResults<const char*>& captures)
@@ -54,9 +128,37 @@ HookManager::HookManager() : m_parent(nullptr) {}
 HookManager::HookManager(HookManager& parent) : SafeCountable{}, m_parent(&parent) {}
 HookManager::~HookManager() = default;
 
+void HookManager::HookList::index(HookData& hook)
+{
+    if (hook.filter_class.kind == FilterKind::Literal or hook.filter_class.kind == FilterKind::Alternation)
+    {
+        for (auto& literal : hook.filter_class.literals)
+            literal_hooks[literal].push_back(&hook);
+    }
+    else
+        other_hooks.push_back(&hook);
+}
+
+void HookManager::HookList::unindex(HookData& hook)
+{
+    if (hook.filter_class.kind == FilterKind::Literal or hook.filter_class.kind == FilterKind::Alternation)
+    {
+        for (auto& literal : hook.filter_class.literals)
+        {
+            auto it = literal_hooks.find(literal);
+            kak_assert(it != literal_hooks.end());
+            it->value.erase(find(it->value, &hook));
+            if (it->value.empty())
+                literal_hooks.remove(it);
+        }
+    }
+    else
+        other_hooks.erase(find(other_hooks, &hook));
+}
+
 void HookManager::add_hook(Hook hook, String group, HookFlags flags, Regex filter, String commands, Context& context)
 {
-    UniquePtr<HookData> hook_data{new HookData{std::move(group), flags, std::move(filter), std::move(commands)}};
+    UniquePtr<HookData> hook_data{new HookData{std::move(group), flags, std::move(filter), std::move(commands), m_next_hook_order++}};
     if (hook == Hook::ModuleLoaded)
     {
         const bool only_always = context.hooks_disabled();
@@ -67,25 +169,29 @@ void HookManager::add_hook(Hook hook, String group, HookFlags flags, Regex filte
             MatchResults<const char*> captures;
             if (hook_data->should_run(only_always, disabled_hooks, name, captures))
             {
+                ++hook_data->match_count;
                 hook_data->exec(hook, name, context, captures);
                 if (hook_data->flags & HookFlags::Once)
                     return;
             }
         }
     }
-    m_hooks[to_underlying(hook)].push_back(std::move(hook_data));
+    auto& hook_list = m_hooks[to_underlying(hook)];
+    hook_list.index(*hook_data);
+    hook_list.hooks.push_back(std::move(hook_data));
 }
 
 void HookManager::remove_hooks(const Regex& regex)
 {
     for (auto& list : m_hooks)
     {
-        list.erase(remove_if(list, [this, &regex](UniquePtr<HookData>& h) {
-                       if (not regex_match(h->group.begin(), h->group.end(), regex))
-                           return false;
-                       m_hooks_trash.push_back(std::move(h));
-                       return true;
-                   }), list.end());
+        list.hooks.erase(remove_if(list.hooks, [this, &list, &regex](UniquePtr<HookData>& h) {
+                             if (not regex_match(h->group.begin(), h->group.end(), regex))
+                                 return false;
+                             list.unindex(*h);
+                             m_hooks_trash.push_back(std::move(h));
+                             return true;
+                         }), list.hooks.end());
     }
 }
 
@@ -94,7 +200,7 @@ CandidateList HookManager::complete_hook_group(StringView prefix, ByteCount pos_
     CandidateList res;
     for (auto& list : m_hooks)
     {
-        auto container = list | transform([](const UniquePtr<HookData>& h) -> const String& { return h->group; });
+        auto container = list.hooks | transform([](const UniquePtr<HookData>& h) -> const String& { return h->group; });
         for (auto& c : complete(prefix, pos_in_token, container))
         {
             if (not contains(res, c))
@@ -109,13 +215,29 @@ void HookManager::run_hook(Hook hook, StringView param, Context& context)
     const bool only_always = context.hooks_disabled();
     auto& disabled_hooks = context.options()["disabled_hooks"].get<Regex>();
 
+    // only the hooks indexed by this parameter and the unindexed ones can match,
+    // merge them back in registration order
+    auto& hook_list = m_hooks[to_underlying(hook)];
+    ConstArrayView<HookData*> literal_hooks;
+    if (auto it = hook_list.literal_hooks.find(param); it != hook_list.literal_hooks.end())
+        literal_hooks = it->value;
+    Vector<HookData*, MemoryDomain::Hooks> candidates;
+    candidates.reserve(literal_hooks.size() + hook_list.other_hooks.size());
+    std::merge(literal_hooks.begin(), literal_hooks.end(),
+               hook_list.other_hooks.begin(), hook_list.other_hooks.end(),
+               std::back_inserter(candidates),
+               [](HookData* lhs, HookData* rhs) { return lhs->order < rhs->order; });
+
     struct ToRun { HookData* hook; MatchResults<const char*> captures; };
     Vector<ToRun> hooks_to_run; // The m_hooks_trash vector ensure hooks wont die during this method
-    for (auto& hook : m_hooks[to_underlying(hook)])
+    for (auto* hook : candidates)
     {
         MatchResults<const char*> captures;
         if (hook->should_run(only_always, disabled_hooks, param, captures))
-            hooks_to_run.push_back({hook.get(), std::move(captures)});
+        {
+            ++hook->match_count;
+            hooks_to_run.push_back({hook, std::move(captures)});
+        }
     }
 
     auto hook_name = enum_desc(Meta::Type<Hook>{})[to_underlying(hook)].name;
@@ -136,7 +258,8 @@ void HookManager::run_hook(Hook hook, StringView param, Context& context)
     if (m_parent)
         m_parent->run_hook(hook, param, context);
 
-    ProfileScope profile{context.options()["debug"].get<DebugFlags>(), [&](std::chrono::microseconds duration) {
+    const auto debug_flags = context.options()["debug"].get<DebugFlags>();
+    ProfileScope profile{debug_flags, [&](std::chrono::microseconds duration) {
         write_to_debug_buffer(format("hook '{}({})' took {} us", hook_name, param, (size_t)duration.count()));
     }};
 
@@ -148,15 +271,18 @@ void HookManager::run_hook(Hook hook, StringView param, Context& context)
             if (contains(m_hooks_trash, to_run.hook))
                 continue;
 
-            to_run.hook->exec(hook, param, context, to_run.captures);
+            {
+                ProfileReportScope profile_report{debug_flags, "hook", hook_name, to_run.hook->group};
+                to_run.hook->exec(hook, param, context, to_run.captures);
+            }
 
             if (to_run.hook->flags & HookFlags::Once)
             {
-                auto& hook_list = m_hooks[to_underlying(hook)];
-                if (auto it = find(hook_list, to_run.hook); it != hook_list.end())
+                if (auto it = find(hook_list.hooks, to_run.hook); it != hook_list.hooks.end())
                 {
+                    hook_list.unindex(*to_run.hook);
                     m_hooks_trash.push_back(std::move(*it));
-                    hook_list.erase(it);
+                    hook_list.hooks.erase(it);
                 }
             }
         }
@@ -174,4 +300,38 @@ void HookManager::run_hook(Hook hook, StringView param, Context& context)
                    hook_name, param), context.faces()["Error"] });
 }
 
+void HookManager::debug_stats() const
+{
+    if (m_parent)
+        m_parent->debug_stats();
+
+    for (size_t i = 0; i < m_hooks.size(); ++i)
+    {
+        for (auto& hook : m_hooks[i].hooks)
+            write_to_debug_buffer(format(" * {}({})/{} [{}]: {} matches",
+                                         enum_desc(Meta::Type<Hook>{})[i].name, hook->filter.str(),
+                                         hook->group, filter_kind_name(hook->filter_class.kind),
+                                         hook->match_count));
+    }
+}
+
+UnitTest test_hook_filter_class{[]()
+{
+    auto check = [](StringView filter, FilterKind kind, std::initializer_list<StringView> literals = {}) {
+        auto res = classify_filter(filter);
+        kak_assert(res.kind == kind);
+        kak_assert(std::equal(res.literals.begin(), res.literals.end(), literals.begin(), literals.end()));
+    };
+    check(".*", FilterKind::MatchAll);
+    check("", FilterKind::Literal, {""});
+    check("<esc>", FilterKind::Literal, {"<esc>"});
+    check("filetype=c\\+\\+", FilterKind::Literal, {"filetype=c++"});
+    check("b|a|b", FilterKind::Alternation, {"a", "b"});
+    check("a|", FilterKind::Alternation, {"", "a"});
+    check(".+", FilterKind::Regex);
+    check("(a|b)", FilterKind::Regex);
+    check("\\d", FilterKind::Regex);
+    check("a\\", FilterKind::Regex);
+}};
+
 }
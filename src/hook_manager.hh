@@ -6,6 +6,7 @@
 #include "meta.hh"
 #include "enum.hh"
 #include "array.hh"
+#include "hash_map.hh"
 #include "unique_ptr.hh"
 
 namespace Kakoune
@@ -132,15 +133,32 @@ public:
     CandidateList complete_hook_group(StringView prefix, ByteCount pos_in_token);
     void run_hook(Hook hook, StringView param, Context& context);
 
+    // writes the hooks of this manager and of its parents, with their match counts
+    void debug_stats() const;
+
 private:
     struct HookData;
 
+    // Hooks in registration order, the ones whose filter only matches some
+    // literal parameters are indexed by these, so that running a hook only
+    // tests the filters that can match its parameter.
+    struct HookList
+    {
+        void index(HookData& hook);
+        void unindex(HookData& hook);
+
+        Vector<UniquePtr<HookData>, MemoryDomain::Hooks> hooks;
+        HashMap<String, Vector<HookData*, MemoryDomain::Hooks>, MemoryDomain::Hooks> literal_hooks;
+        Vector<HookData*, MemoryDomain::Hooks> other_hooks;
+    };
+
     HookManager();
     // the only one allowed to construct a root hook manager
     friend class Scope;
 
     SafePtr<HookManager> m_parent;
-    Array<Vector<UniquePtr<HookData>, MemoryDomain::Hooks>, enum_desc(Meta::Type<Hook>{}).size()> m_hooks;
+    Array<HookList, enum_desc(Meta::Type<Hook>{}).size()> m_hooks;
+    size_t m_next_hook_order = 0;
 
     mutable Vector<std::pair<Hook, StringView>, MemoryDomain::Hooks> m_running_hooks;
     mutable Vector<UniquePtr<HookData>, MemoryDomain::Hooks> m_hooks_trash;
@@ -8,6 +8,7 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <cstring>
 
 namespace Kakoune
 {
@@ -18,25 +19,7 @@ String to_json(StringView str)
 {
     String res;
     res.reserve(str.length() + 4);
-    res += '"';
-    for (auto it = str.begin(), end = str.end(); it != end; )
-    {
-        auto next = std::find_if(it, end, [](char c) {
-            return c == '\\' or c == '"' or (unsigned char) c <= 0x1F;
-        });
-
-        res += StringView{it, next};
-        if (next == end)
-            break;
-
-        char buf[7] = {'\\', *next, 0};
-        if ((unsigned char) *next <= 0x1F)
-            format_to(buf, "\\u{:04}", hex(*next));
-
-        res += buf;
-        it = next+1;
-    }
-    res += '"';
+    write_json_string(str, [&](StringView part) { res += part; });
     return res;
 }
 
@@ -64,28 +47,30 @@ JsonResult parse_json_impl(const char* pos, const char* end, size_t depth)
         return { Value{false}, pos+5 };
     if (*pos == '"')
     {
+        // memchr is vectorized by the libc, which makes finding the end of
+        // long strings much faster than a byte by byte scan. The next quote
+        // is only searched again once an escape went past it, so that many
+        // escapes do not rescan the rest of the string each time.
         String value;
-        bool escaped = false;
-        ++pos;
-        for (auto string_end = pos; string_end != end; ++string_end)
+        const char* quote = nullptr;
+        for (++pos; ; )
         {
-            if (escaped)
+            if (not quote or quote < pos)
             {
-                escaped = false;
-                value += StringView{pos, string_end};
-                value.back() = *string_end;
-                pos = string_end+1;
-                continue;
+                quote = static_cast<const char*>(memchr(pos, '"', end - pos));
+                if (not quote)
+                    return {};
             }
-            if (*string_end == '\\')
-                escaped = true;
-            if (*string_end == '"')
+            auto backslash = static_cast<const char*>(memchr(pos, '\\', quote - pos));
+            if (not backslash)
             {
-                value += StringView{pos, string_end};
-                return {std::move(value), string_end+1};
+                value += StringView{pos, quote};
+                return {std::move(value), quote+1};
             }
+            value += StringView{pos, backslash};
+            value += StringView{backslash+1, backslash+2};
+            pos = backslash+2;
         }
-        return {};
     }
     if (*pos == '[')
     {
@@ -168,6 +153,36 @@ UnitTest test_json_parser{[]()
         kak_assert(value.as<JsonArray>().at(1).as<int>() == 20);
     }
 
+    {
+        auto value = parse_json(R"("a\"b\\c\"")").value;
+        kak_assert(value.as<String>() == R"(a"b\c")");
+        kak_assert(not parse_json(R"("unterminated\")").value);
+    }
+
+    {
+        String json = "\"";
+        String expected;
+        for (int i = 0; i < 10000; ++i)
+        {
+            json += i % 2 ? "ab\\\\" : "\\\"c";
+            expected += i % 2 ? "ab\\" : "\"c";
+        }
+        json += "\"";
+        auto [value, value_end] = parse_json(json);
+        kak_assert(value.as<String>() == expected);
+        kak_assert(value_end == json.end());
+        kak_assert(not parse_json(json.substr(0_byte, json.length() - 1)).value);
+    }
+
+    {
+        StringView requests = R"({ "method": "keys" }{ "method": "scroll" } { "meth)";
+        auto [first, first_end] = parse_json(requests);
+        kak_assert(first.as<JsonObject>().get("method"_sv).as<String>() == "keys");
+        auto [second, second_end] = parse_json(first_end, requests.end());
+        kak_assert(second.as<JsonObject>().get("method"_sv).as<String>() == "scroll");
+        kak_assert(not parse_json(second_end, requests.end()).value);
+    }
+
     {
         auto value = parse_json("-1").value;
         kak_assert(value.as<int>() == -1);
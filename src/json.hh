@@ -1,17 +1,45 @@
 #ifndef json_hh_INCLUDED
 #define json_hh_INCLUDED
 
+#include "format.hh"
 #include "hash_map.hh"
 #include "string.hh"
 #include "string_utils.hh"
 #include "value.hh"
 
+#include <algorithm>
+
 namespace Kakoune
 {
 
 using JsonArray = Vector<Value>;
 using JsonObject = HashMap<String, Value>;
 
+// Calls write with the successive parts of the quoted and escaped str
+template<typename Write>
+void write_json_string(StringView str, Write&& write)
+{
+    write("\"");
+    for (auto it = str.begin(), end = str.end(); it != end; )
+    {
+        auto next = std::find_if(it, end, [](char c) {
+            return c == '\\' or c == '"' or (unsigned char) c <= 0x1F;
+        });
+
+        write(StringView{it, next});
+        if (next == end)
+            break;
+
+        char buf[7] = {'\\', *next, 0};
+        if ((unsigned char) *next <= 0x1F)
+            format_to(buf, "\\u{:04}", hex(*next));
+
+        write(StringView{buf});
+        it = next+1;
+    }
+    write("\"");
+}
+
 String to_json(int i);
 String to_json(bool b);
 String to_json(StringView str);
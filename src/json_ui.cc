@@ -5,10 +5,12 @@
 #include "exception.hh"
 #include "file.hh"
 #include "json.hh"
+#include "msgpack.hh"
 #include "keys.hh"
 #include "ranges.hh"
 #include "string_utils.hh"
 #include "format.hh"
+#include "unit_tests.hh"
 
 #include <cstdio>
 #include <utility>
@@ -23,135 +25,321 @@ struct invalid_rpc_request : runtime_error {
         : runtime_error(format("invalid json rpc request ({})", message)) {}
 };
 
-String to_json(Color color)
+String color_string(Color color)
 {
     if (color.color == Kakoune::Color::RGB)
     {
-        char buffer[10];
-        format_to(buffer, R"("#{:02}{:02}{:02}")", hex(color.r), hex(color.g), hex(color.b));
-        return buffer;
+        char buffer[8];
+        return format_to(buffer, "#{:02}{:02}{:02}", hex(color.r), hex(color.g), hex(color.b)).str();
     }
-    return to_json(to_string(color));
+    return to_string(color);
 }
 
+struct AttributeName { Attribute attr; StringView name; };
+constexpr AttributeName attribute_names[] {
+    { Attribute::Underline, "underline" },
+    { Attribute::CurlyUnderline, "curly_underline" },
+    { Attribute::DoubleUnderline, "double_underline" },
+    { Attribute::Reverse, "reverse" },
+    { Attribute::Blink, "blink" },
+    { Attribute::Bold, "bold" },
+    { Attribute::Dim, "dim" },
+    { Attribute::Italic, "italic" },
+    { Attribute::FinalFg, "final_fg" },
+    { Attribute::FinalBg, "final_bg" },
+    { Attribute::FinalAttr, "final_attr" },
+    { Attribute::Strikethrough, "strikethrough" },
+};
+
 String to_json(Attribute attributes)
 {
-    struct Attr { Attribute attr; StringView name; }
-    attrs[] {
-        { Attribute::Underline, "underline" },
-        { Attribute::CurlyUnderline, "curly_underline" },
-        { Attribute::DoubleUnderline, "double_underline" },
-        { Attribute::Reverse, "reverse" },
-        { Attribute::Blink, "blink" },
-        { Attribute::Bold, "bold" },
-        { Attribute::Dim, "dim" },
-        { Attribute::Italic, "italic" },
-        { Attribute::FinalFg, "final_fg" },
-        { Attribute::FinalBg, "final_bg" },
-        { Attribute::FinalAttr, "final_attr" },
-        { Attribute::Strikethrough, "strikethrough" },
-    };
-
-    return "[" + join(attrs |
-                      filter([=](const Attr& a) { return attributes & a.attr; }) |
-                      transform([](const Attr& a) { return to_json(a.name); }),
+    return "[" + join(attribute_names |
+                      filter([=](const AttributeName& a) { return attributes & a.attr; }) |
+                      transform([](const AttributeName& a) { return to_json(a.name); }),
                       ',', false) + "]";
 }
 
 String to_json(Face face)
 {
     return format(R"(\{ "fg": {}, "bg": {}, "underline": {}, "attributes": {} })",
-                  to_json(face.fg), to_json(face.bg), to_json(face.underline), to_json(face.attributes));
-}
-
-String to_json(const DisplayAtom& atom)
-{
-    return format(R"(\{ "face": {}, "contents": {} })", to_json(atom.face), to_json(atom.content()));
-}
-
-String to_json(const DisplayLine& line)
-{
-    return to_json(line.atoms());
-}
-
-String to_json(ColumnCount column)
-{
-    return format("{}", column);
-}
-
-String to_json(DisplayCoord coord)
-{
-    return format(R"(\{ "line": {}, "column": {} })", coord.line, coord.column);
+                  to_json(color_string(face.fg)), to_json(color_string(face.bg)),
+                  to_json(color_string(face.underline)), to_json(face.attributes));
 }
 
-String to_json(MenuStyle style)
+StringView style_name(MenuStyle style)
 {
     switch (style)
     {
-        case MenuStyle::Prompt: return R"("prompt")";
-        case MenuStyle::Search: return R"("search")";
-        case MenuStyle::Inline: return R"("inline")";
+        case MenuStyle::Prompt: return "prompt";
+        case MenuStyle::Search: return "search";
+        case MenuStyle::Inline: return "inline";
     }
     return "";
 }
 
-String to_json(InfoStyle style)
+StringView style_name(InfoStyle style)
 {
     switch (style)
     {
-        case InfoStyle::Prompt: return R"("prompt")";
-        case InfoStyle::Inline: return R"("inline")";
-        case InfoStyle::InlineAbove: return R"("inlineAbove")";
-        case InfoStyle::InlineBelow: return R"("inlineBelow")";
-        case InfoStyle::MenuDoc: return R"("menuDoc")";
-        case InfoStyle::Modal: return R"("modal")";
+        case InfoStyle::Prompt: return "prompt";
+        case InfoStyle::Inline: return "inline";
+        case InfoStyle::InlineAbove: return "inlineAbove";
+        case InfoStyle::InlineBelow: return "inlineBelow";
+        case InfoStyle::MenuDoc: return "menuDoc";
+        case InfoStyle::Modal: return "modal";
     }
     return "";
 }
 
-String to_json(StatusStyle style)
+StringView style_name(StatusStyle style)
 {
     switch (style)
     {
-        case StatusStyle::Status: return R"("status")";
-        case StatusStyle::Command: return R"("command")";
-        case StatusStyle::Search: return R"("search")";
-        case StatusStyle::Prompt: return R"("prompt")";
+        case StatusStyle::Status: return "status";
+        case StatusStyle::Command: return "command";
+        case StatusStyle::Search: return "search";
+        case StatusStyle::Prompt: return "prompt";
     }
     return "";
 }
 
-String concat()
+// Serializes rpc calls directly into a reusable buffer instead of building
+// intermediate strings. Faces repeat a lot in a draw, so they are cached
+// as already serialized fragments.
+class JsonWriter
 {
-    return "";
-}
+public:
+    JsonWriter(int fd) : m_writer{fd} {}
+
+    template<typename... Args>
+    void rpc_call(StringView method, Args&&... args)
+    {
+        m_writer.write(R"({ "jsonrpc": "2.0", "method": ")");
+        m_writer.write(method);
+        m_writer.write(R"(", "params": [)");
+        bool first = true;
+        ((first ? (void)(first = false) : m_writer.write(", "), write(args)), ...);
+        m_writer.write("] }\n");
+        m_writer.flush();
+    }
+
+private:
+    void write(int i) { m_writer.write(to_string(i)); }
+    void write(bool b) { m_writer.write(b ? "true" : "false"); }
+    void write(ColumnCount column) { write((int)column); }
+    void write(MenuStyle style) { write(style_name(style)); }
+    void write(InfoStyle style) { write(style_name(style)); }
+    void write(StatusStyle style) { write(style_name(style)); }
 
-template<typename First, typename... Args>
-String concat(First&& first, Args&&... args)
+    void write(StringView str)
+    {
+        write_json_string(str, [this](StringView part) { m_writer.write(part); });
+    }
+
+    void write(const String& str) { write(StringView{str}); }
+
+    void write(DisplayCoord coord)
+    {
+        char buffer[64];
+        m_writer.write(format_to(buffer, R"(\{ "line": {}, "column": {} })", coord.line, coord.column));
+    }
+
+    void write(const Face& face)
+    {
+        if (m_face_cache.size() >= max_cached_faces and not m_face_cache.contains(face))
+            m_face_cache.clear();
+        auto& fragment = m_face_cache[face];
+        if (fragment.empty())
+            fragment = to_json(face);
+        m_writer.write(fragment);
+    }
+
+    void write(const DisplayAtom& atom)
+    {
+        m_writer.write(R"({ "face": )");
+        write(atom.face);
+        m_writer.write(R"(, "contents": )");
+        write(atom.content());
+        m_writer.write(" }");
+    }
+
+    void write(const DisplayLine& line) { write(line.atoms()); }
+
+    template<typename T>
+    void write(ConstArrayView<T> array)
+    {
+        m_writer.write("[");
+        bool first = true;
+        for (auto& elem : array)
+        {
+            if (not first)
+                m_writer.write(", ");
+            first = false;
+            write(elem);
+        }
+        m_writer.write("]");
+    }
+
+    template<typename T, MemoryDomain D>
+    void write(const Vector<T, D>& vec) { write(ConstArrayView<T>{vec}); }
+
+    template<typename K, typename V, MemoryDomain D>
+    void write(const HashMap<K, V, D>& map)
+    {
+        m_writer.write("{");
+        bool first = true;
+        for (auto& item : map)
+        {
+            if (not first)
+                m_writer.write(",");
+            first = false;
+            write(item.key);
+            m_writer.write(": ");
+            write(item.value);
+        }
+        m_writer.write("}");
+    }
+
+    static constexpr size_t max_cached_faces = 1024;
+
+    BufferedWriter<false, 65536> m_writer;
+    HashMap<Face, String, MemoryDomain::Display> m_face_cache;
+};
+
+// Same rpc calls encoded as MessagePack-RPC notifications. Faces are sent
+// as [id, face] the first time they are used, and as their id afterwards.
+class MsgpackWriter
 {
-    if (sizeof...(Args) != 0)
-        return to_json(first) + ", " + concat(args...);
-    return to_json(first);
-}
+public:
+    MsgpackWriter(int fd) : m_writer{fd} {}
+
+    template<typename... Args>
+    void rpc_call(StringView method, Args&&... args)
+    {
+        write_msgpack_array(m_writer, 3);
+        write(2);
+        write(method);
+        write_msgpack_array(m_writer, sizeof...(Args));
+        (write(args), ...);
+        m_writer.flush();
+    }
+
+private:
+    void write(int i) { write_msgpack(m_writer, i); }
+    void write(bool b) { write_msgpack(m_writer, b); }
+    void write(ColumnCount column) { write((int)column); }
+    void write(StringView str) { write_msgpack(m_writer, str); }
+    void write(const String& str) { write(StringView{str}); }
+    void write(MenuStyle style) { write(style_name(style)); }
+    void write(InfoStyle style) { write(style_name(style)); }
+    void write(StatusStyle style) { write(style_name(style)); }
+
+    void write(DisplayCoord coord)
+    {
+        write_msgpack_map(m_writer, 2);
+        write("line"_sv);
+        write((int)coord.line);
+        write("column"_sv);
+        write((int)coord.column);
+    }
+
+    void write(Attribute attributes)
+    {
+        write_msgpack_array(m_writer, std::count_if(std::begin(attribute_names), std::end(attribute_names),
+                                                    [=](const AttributeName& a) { return (bool)(attributes & a.attr); }));
+        for (auto& [attr, name] : attribute_names)
+        {
+            if (attributes & attr)
+                write(name);
+        }
+    }
+
+    void write(const Face& face)
+    {
+        if (auto it = m_face_ids.find(face); it != m_face_ids.end())
+            return write(it->value);
+
+        if (m_face_ids.size() >= max_interned_faces)
+            m_face_ids.clear();
+        const int id = (int)m_face_ids.size();
+        m_face_ids.insert({face, id});
+
+        write_msgpack_array(m_writer, 2);
+        write(id);
+        write_msgpack_map(m_writer, 4);
+        write("fg"_sv);
+        write(color_string(face.fg));
+        write("bg"_sv);
+        write(color_string(face.bg));
+        write("underline"_sv);
+        write(color_string(face.underline));
+        write("attributes"_sv);
+        write(face.attributes);
+    }
+
+    void write(const DisplayAtom& atom)
+    {
+        write_msgpack_map(m_writer, 2);
+        write("face"_sv);
+        write(atom.face);
+        write("contents"_sv);
+        write(atom.content());
+    }
+
+    void write(const DisplayLine& line) { write(line.atoms()); }
+
+    template<typename T>
+    void write(ConstArrayView<T> array)
+    {
+        write_msgpack_array(m_writer, array.size());
+        for (auto& elem : array)
+            write(elem);
+    }
+
+    template<typename T, MemoryDomain D>
+    void write(const Vector<T, D>& vec) { write(ConstArrayView<T>{vec}); }
+
+    template<typename K, typename V, MemoryDomain D>
+    void write(const HashMap<K, V, D>& map)
+    {
+        write_msgpack_map(m_writer, map.size());
+        for (auto& item : map)
+        {
+            write(item.key);
+            write(item.value);
+        }
+    }
+
+    static constexpr size_t max_interned_faces = 1024;
+
+    BufferedWriter<false, 65536> m_writer;
+    HashMap<Face, int, MemoryDomain::Display> m_face_ids;
+};
 
 template<typename... Args>
-void rpc_call(StringView method, Args&&... args)
+void JsonUI::rpc_call(StringView method, Args&&... args)
 {
-    auto q = format(R"(\{ "jsonrpc": "2.0", "method": "{}", "params": [{}] }{})",
-                    method, concat(std::forward<Args>(args)...), "\n");
-
-    write(1, q);
+    if (m_encoding == Encoding::MessagePack)
+        m_msgpack_writer->rpc_call(method, std::forward<Args>(args)...);
+    else
+        m_json_writer->rpc_call(method, std::forward<Args>(args)...);
 }
 
-JsonUI::JsonUI()
+JsonUI::JsonUI(Encoding encoding)
     : m_stdin_watcher{0, FdEvents::Read, EventMode::Urgent,
                       [this](FDWatcher&, FdEvents, EventMode mode) {
         parse_requests(mode);
-      }}, m_dimensions{24, 80}
+      }}, m_encoding{encoding}, m_dimensions{24, 80}
 {
+    if (encoding == Encoding::MessagePack)
+        m_msgpack_writer = make_unique_ptr<MsgpackWriter>(1);
+    else
+        m_json_writer = make_unique_ptr<JsonWriter>(1);
     set_signal_handler(SIGINT, SIG_DFL);
 }
 
+JsonUI::~JsonUI() = default;
+
 void JsonUI::draw(const DisplayBuffer& display_buffer, DisplayCoord cursor_pos,
                   const Face& default_face, const Face& padding_face,
                   ColumnCount widget_columns)
@@ -251,8 +439,27 @@ void JsonUI::eval_json(const Value& json)
         throw invalid_rpc_request("params missing");
     else if (not params_it->value.is_a<JsonArray>())
         throw invalid_rpc_request("'params' is not an array");
-    const JsonArray& params = params_it->value.as<JsonArray>();
+    eval_request(method, params_it->value.as<JsonArray>());
+}
+
+void JsonUI::eval_msgpack(const Value& msgpack)
+{
+    if (not msgpack.is_a<JsonArray>())
+        throw invalid_rpc_request("request is not an array");
 
+    const JsonArray& request = msgpack.as<JsonArray>();
+    if (request.size() != 3 or not request[0].is_a<int>() or request[0].as<int>() != 2)
+        throw invalid_rpc_request("only notifications are supported");
+    else if (not request[1].is_a<String>())
+        throw invalid_rpc_request("'method' is not a string");
+    else if (not request[2].is_a<JsonArray>())
+        throw invalid_rpc_request("'params' is not an array");
+
+    eval_request(request[1].as<String>(), request[2].as<JsonArray>());
+}
+
+void JsonUI::eval_request(StringView method, ConstArrayView<Value> params)
+{
     if (method == "keys")
     {
         for (auto& key_val : params)
@@ -332,7 +539,7 @@ void JsonUI::eval_json(const Value& json)
 
 void JsonUI::parse_requests(EventMode mode)
 {
-    constexpr size_t bufsize = 1024;
+    constexpr size_t bufsize = 4096;
     char buf[bufsize];
     while (fd_readable(0))
     {
@@ -349,28 +556,207 @@ void JsonUI::parse_requests(EventMode mode)
     if (not m_on_key)
         return;
 
-    while (not m_requests.empty())
+    // steal requests as we might receive new ones while handling them.
+    // Complete requests are all parsed in one pass, and only the unparsed
+    // tail is kept instead of copying the remaining ones after each.
+    const String requests = std::move(m_requests);
+    const char* pos = requests.begin();
+    const char* end = requests.end();
+    OnScopeEnd keep_unparsed{[&] { m_requests = StringView{pos, end} + m_requests; }};
+
+    while (pos != end)
     {
-        const char* pos = nullptr;
+        const char* next = nullptr;
         try
         {
-            auto [json, new_pos] = parse_json(m_requests);
-            pos = new_pos;
-            if (json)
-                eval_json(json);
+            auto [request, new_pos] = m_encoding == Encoding::MessagePack ?
+                parse_msgpack(pos, end) : parse_json(pos, end);
+            next = new_pos;
+            if (request and m_encoding == Encoding::MessagePack)
+                eval_msgpack(request);
+            else if (request)
+                eval_json(request);
+        }
+        catch (cancel&)
+        {
+            // let the code waiting for events handle it, as with the terminal ui,
+            // the following requests get parsed on the next event loop iteration
+            pos = next;
+            if (pos != end)
+                EventManager::instance().force_signal(m_stdin_watcher.fd());
+            throw;
         }
         catch (runtime_error& error)
         {
-            write(2, format("error while handling requests '{}': '{}'\n",
-                            m_requests, error.what()));
-            // try to salvage request by dropping its first line
-            pos = std::min(m_requests.end(), find(m_requests, '\n')+1);
+            if (m_encoding == Encoding::MessagePack)
+            {
+                write(2, format("error while handling requests: '{}'\n", error.what()));
+                // binary requests that failed to parse cannot be resynchronized
+                if (not next)
+                    next = end;
+            }
+            else
+            {
+                write(2, format("error while handling requests '{}': '{}'\n",
+                                StringView{pos, end}, error.what()));
+                // try to salvage request by dropping its first line
+                next = std::min(end, std::find(pos, end, '\n')+1);
+            }
         }
-        if (not pos)
+        if (not next)
             break; // unterminated request ?
 
-        m_requests = String{pos, m_requests.end()};
+        pos = next;
+    }
+}
+
+template<typename Writer>
+static String write_output(auto&& call)
+{
+    char path[] = "/tmp/kak-json-writer.XXXXXX";
+    int fd = mkstemp(path);
+    kak_assert(fd != -1);
+    unlink(path);
+    {
+        Writer writer{fd};
+        call(writer);
+    }
+    lseek(fd, 0, SEEK_SET);
+    String res = read_fd(fd);
+    close(fd);
+    return res;
+}
+
+UnitTest test_json_writer{[]()
+{
+    auto output = [](auto&& call) { return write_output<JsonWriter>(call); };
+
+    const Face face{Color::Red, Color{0x10, 0x20, 0xff}, Attribute::Bold | Attribute::Italic};
+    kak_assert(output([&](JsonWriter& writer) {
+        writer.rpc_call("draw_status", DisplayLine{{DisplayAtom{"a\"b", face}, DisplayAtom{"\033"}}},
+                        2_col, DisplayCoord{1, 2}, StatusStyle::Prompt, true,
+                        UserInterface::Options{{"k", "v"}, {"l", "w"}});
+        writer.rpc_call("menu_hide");
+    }) == R"({ "jsonrpc": "2.0", "method": "draw_status", "params": [)"
+          R"([{ "face": { "fg": "red", "bg": "rgb:1020ff", "underline": "default", "attributes": ["bold","italic"] }, "contents": "a\"b" }, )"
+          R"({ "face": { "fg": "default", "bg": "default", "underline": "default", "attributes": [] }, "contents": "\u001b" }], )"
+          R"(2, { "line": 1, "column": 2 }, "prompt", true, {"k": "v","l": "w"}] })" "\n"
+          R"({ "jsonrpc": "2.0", "method": "menu_hide", "params": [] })" "\n");
+
+    // Serialize a 300x100 display buffer and check it parses back
+    DisplayBuffer display_buffer;
+    const Face faces[] = { {}, face, {Color::Blue, Color::Default}, {Color::Default, Color::Default, Attribute::Reverse} };
+    for (int line = 0; line < 100; ++line)
+    {
+        AtomList atoms;
+        for (int atom = 0; atom < 30; ++atom)
+            atoms.push_back({format("{:10}", line * 30 + atom), faces[(line + atom) % 4]});
+        display_buffer.lines().push_back(DisplayLine{std::move(atoms)});
+    }
+    auto json = output([&](JsonWriter& writer) {
+        writer.rpc_call("draw", display_buffer.lines(), DisplayCoord{}, Face{}, Face{}, 0_col);
+    });
+    auto value = parse_json(json).value;
+    kak_assert(value.is_a<JsonObject>());
+    auto& lines = value.as<JsonObject>().get("params"_sv).as<JsonArray>()[0].as<JsonArray>();
+    kak_assert(lines.size() == 100);
+    auto& atom = lines[42].as<JsonArray>()[19].as<JsonObject>();
+    kak_assert(atom.get("contents"_sv).as<String>() == "      1279");
+    kak_assert(atom.get("face"_sv).as<JsonObject>().get("fg"_sv).as<String>() == "red");
+}};
+
+
+// Compares a value parsed from json with one decoded from msgpack, where
+// faces are interned
+static bool same_value(const Value& json, const Value& msgpack, HashMap<int, const Value*>& faces)
+{
+    if (json.is_a<JsonObject>() and json.as<JsonObject>().contains("fg"_sv) and not msgpack.is_a<JsonObject>())
+    {
+        if (msgpack.is_a<int>())
+        {
+            auto it = faces.find(msgpack.as<int>());
+            return it != faces.end() and same_value(json, *it->value, faces);
+        }
+        if (not msgpack.is_a<JsonArray>() or msgpack.as<JsonArray>().size() != 2)
+            return false;
+        auto& definition = msgpack.as<JsonArray>();
+        faces[definition[0].as<int>()] = &definition[1];
+        return same_value(json, definition[1], faces);
+    }
+
+    if (json.is_a<int>())
+        return msgpack.is_a<int>() and msgpack.as<int>() == json.as<int>();
+    if (json.is_a<bool>())
+        return msgpack.is_a<bool>() and msgpack.as<bool>() == json.as<bool>();
+    if (json.is_a<String>())
+        return msgpack.is_a<String>() and msgpack.as<String>() == json.as<String>();
+    if (json.is_a<JsonArray>())
+    {
+        if (not msgpack.is_a<JsonArray>())
+            return false;
+        auto& lhs = json.as<JsonArray>();
+        auto& rhs = msgpack.as<JsonArray>();
+        return lhs.size() == rhs.size() and
+               std::equal(lhs.begin(), lhs.end(), rhs.begin(),
+                          [&](const Value& l, const Value& r) { return same_value(l, r, faces); });
     }
+    if (not json.is_a<JsonObject>() or not msgpack.is_a<JsonObject>())
+        return false;
+    auto& lhs = json.as<JsonObject>();
+    auto& rhs = msgpack.as<JsonObject>();
+    return lhs.size() == rhs.size() and
+           all_of(lhs, [&](auto& item) {
+               auto it = rhs.find(item.key);
+               return it != rhs.end() and same_value(item.value, it->value, faces);
+           });
 }
 
+UnitTest test_msgpack_writer{[]()
+{
+    const Face faces[] = { {}, {Color::Red, Color{0x10, 0x20, 0xff}, Attribute::Bold | Attribute::Italic}, {Color::Blue, Color::Default} };
+    DisplayBuffer display_buffer;
+    for (int line = 0; line < 20; ++line)
+    {
+        AtomList atoms;
+        for (int atom = 0; atom < 5; ++atom)
+            atoms.push_back({format("{}:{} \"é", line, atom), faces[(line + atom) % 3]});
+        display_buffer.lines().push_back(DisplayLine{std::move(atoms)});
+    }
+    const DisplayLine line{{DisplayAtom{"mode", faces[1]}, DisplayAtom{String{'x', CharCount{300}}, faces[2]}}};
+
+    auto calls = [&](auto& writer) {
+        writer.rpc_call("draw", display_buffer.lines(), DisplayCoord{3, 70000}, faces[0], faces[2], 2_col);
+        writer.rpc_call("draw_status", DisplayLine{}, line, -1_col, line, faces[1], StatusStyle::Command);
+        writer.rpc_call("menu_show", display_buffer.lines(), DisplayCoord{}, faces[1], faces[0], MenuStyle::Inline);
+        writer.rpc_call("menu_select", -40000);
+        writer.rpc_call("info_show", line, display_buffer.lines(), DisplayCoord{1, 2}, faces[2], InfoStyle::MenuDoc);
+        writer.rpc_call("set_ui_options", UserInterface::Options{{"a", "b"}, {"c", ""}});
+        writer.rpc_call("refresh", true);
+    };
+    const String json = write_output<JsonWriter>(calls);
+    const String msgpack = write_output<MsgpackWriter>(calls);
+    kak_assert(msgpack.length() * 3 < json.length());
+
+    Vector<Value> messages; // keep interned faces alive
+    HashMap<int, const Value*> interned_faces;
+    const char* json_pos = json.begin();
+    const char* msgpack_pos = msgpack.begin();
+    for (int i = 0; i < 7; ++i)
+    {
+        auto [json_value, json_end] = parse_json(json_pos, json.end());
+        auto [msgpack_value, msgpack_end] = parse_msgpack(msgpack_pos, msgpack.end());
+        json_pos = json_end;
+        msgpack_pos = msgpack_end;
+
+        auto& object = json_value.as<JsonObject>();
+        auto& request = msgpack_value.as<JsonArray>();
+        kak_assert(request.size() == 3 and request[0].as<int>() == 2);
+        kak_assert(request[1].as<String>() == object.get("method"_sv).as<String>());
+        kak_assert(same_value(object.get("params"_sv), request[2], interned_faces));
+        messages.push_back(std::move(msgpack_value));
+    }
+    kak_assert(msgpack_pos == msgpack.end());
+    kak_assert(interned_faces.size() == 3);
+}};
+
 }
@@ -5,16 +5,26 @@
 #include "event_manager.hh"
 #include "coord.hh"
 #include "string.hh"
+#include "unique_ptr.hh"
 
 namespace Kakoune
 {
 
 struct Value;
+class JsonWriter;
+class MsgpackWriter;
 
 class JsonUI : public UserInterface
 {
 public:
-    JsonUI();
+    enum class Encoding
+    {
+        Json,
+        MessagePack
+    };
+
+    JsonUI(Encoding encoding = Encoding::Json);
+    ~JsonUI() override;
 
     JsonUI(const JsonUI&) = delete;
     JsonUI& operator=(const JsonUI&) = delete;
@@ -53,10 +63,18 @@ public:
     void set_ui_options(const Options& options) override;
 
 private:
+    template<typename... Args>
+    void rpc_call(StringView method, Args&&... args);
+
     void parse_requests(EventMode mode);
     void eval_json(const Value& value);
+    void eval_msgpack(const Value& value);
+    void eval_request(StringView method, ConstArrayView<Value> params);
 
     FDWatcher m_stdin_watcher;
+    Encoding m_encoding;
+    UniquePtr<JsonWriter> m_json_writer;
+    UniquePtr<MsgpackWriter> m_msgpack_writer;
     OnKeyCallback m_on_key;
     OnPasteCallback m_on_paste;
     Vector<Key, MemoryDomain::Client> m_pending_keys;
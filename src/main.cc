@@ -31,6 +31,7 @@
 #include "string.hh"
 #include "unit_tests.hh"
 #include "window.hh"
+#include "worker_pool.hh"
 
 #include <fcntl.h>
 #include <locale.h>
@@ -156,11 +157,13 @@ const EnvVarDesc builtin_env_vars[] = { {
     }, {
         "buf_line_count", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return {to_string(context.buffer().line_count())}; }
+        { return {to_string(context.buffer().line_count())}; },
+        true
     }, {
         "timestamp", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return {to_string(context.buffer().timestamp())}; }
+        { return {to_string(context.buffer().timestamp())}; },
+        true
     }, {
         "history_id", false,
         [](StringView name, const Context& context) -> Vector<String>
@@ -169,11 +172,13 @@ const EnvVarDesc builtin_env_vars[] = { {
         "selection", false,
         [](StringView name, const Context& context) -> Vector<String>
         { const Selection& sel = context.selections().main();
-          return {content(context.buffer(), sel)}; }
+          return {content(context.buffer(), sel)}; },
+        true
     }, {
         "selections", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return context.selections_content(); }
+        { return context.selections_content(); },
+        true
     }, {
         "runtime", false,
         [](StringView name, const Context& context) -> Vector<String>
@@ -189,7 +194,8 @@ const EnvVarDesc builtin_env_vars[] = { {
     }, {
         "opt_", true,
         [](StringView name, const Context& context) -> Vector<String>
-        { return context.options()[name.substr(4_byte)].get_as_strings(); }
+        { return context.options()[name.substr(4_byte)].get_as_strings(); },
+        true
     }, {
         "main_reg_", true,
         [](StringView name, const Context& context) -> Vector<String>
@@ -228,34 +234,40 @@ const EnvVarDesc builtin_env_vars[] = { {
     }, {
         "cursor_line", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return {to_string(context.selections().main().cursor().line + 1)}; }
+        { return {to_string(context.selections().main().cursor().line + 1)}; },
+        true
     }, {
         "cursor_column", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return {to_string(context.selections().main().cursor().column + 1)}; }
+        { return {to_string(context.selections().main().cursor().column + 1)}; },
+        true
     }, {
         "cursor_char_value", false,
         [](StringView name, const Context& context) -> Vector<String>
         { auto coord = context.selections().main().cursor();
           auto& buffer = context.buffer();
-          return {to_string((size_t)utf8::codepoint(buffer.iterator_at(coord), buffer.end()))}; }
+          return {to_string((size_t)utf8::codepoint(buffer.iterator_at(coord), buffer.end()))}; },
+        true
     }, {
         "cursor_char_column", false,
         [](StringView name, const Context& context) -> Vector<String>
         { auto coord = context.selections().main().cursor();
-          return {to_string(context.buffer()[coord.line].char_count_to(coord.column) + 1)}; }
+          return {to_string(context.buffer()[coord.line].char_count_to(coord.column) + 1)}; },
+        true
     }, {
         "cursor_display_column", false,
         [](StringView name, const Context& context) -> Vector<String>
         { auto coord = context.selections().main().cursor();
           return {to_string(get_column(context.buffer(),
                                        context.options()["tabstop"].get<int>(),
-                                       coord) + 1)}; }
+                                       coord) + 1)}; },
+        true
     }, {
         "cursor_byte_offset", false,
         [](StringView name, const Context& context) -> Vector<String>
         { auto cursor = context.selections().main().cursor();
-          return {to_string(context.buffer().distance({0,0}, cursor))}; }
+          return {to_string(context.buffer().distance({0,0}, cursor))}; },
+        true
     }, {
         "recording_register", false,
         [](StringView name, const Context& context) -> Vector<String>
@@ -264,43 +276,50 @@ const EnvVarDesc builtin_env_vars[] = { {
     }, {
         "selection_desc", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return {selection_to_string(ColumnType::Byte, context.buffer(), context.selections().main())}; }
+        { return {selection_to_string(ColumnType::Byte, context.buffer(), context.selections().main())}; },
+        true
     }, {
         "selections_desc", false,
         [](StringView name, const Context& context) -> Vector<String>
         { return main_sel_first(context.selections()) |
                      transform([&buffer=context.buffer()](const Selection& sel) {
                          return selection_to_string(ColumnType::Byte, buffer, sel);
-                     }) | gather<Vector<String>>(); }
+                     }) | gather<Vector<String>>(); },
+        true
     }, {
         "selections_char_desc", false,
         [](StringView name, const Context& context) -> Vector<String>
         { return main_sel_first(context.selections()) |
                      transform([&buffer=context.buffer()](const Selection& sel) {
                          return selection_to_string(ColumnType::Codepoint, buffer, sel);
-                     }) | gather<Vector<String>>(); }
+                     }) | gather<Vector<String>>(); },
+        true
     }, {
         "selections_display_column_desc", false,
         [](StringView name, const Context& context) -> Vector<String>
         { return main_sel_first(context.selections()) |
                      transform([&buffer=context.buffer(), tabstop=context.options()["tabstop"].get<int>()](const Selection& sel) {
                          return selection_to_string(ColumnType::DisplayColumn, buffer, sel, tabstop);
-                     }) | gather<Vector<String>>(); }
+                     }) | gather<Vector<String>>(); },
+        true
     }, {
         "selection_length", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return {to_string(char_length(context.buffer(), context.selections().main()))}; }
+        { return {to_string(char_length(context.buffer(), context.selections().main()))}; },
+        true
     }, {
         "selections_length", false,
         [](StringView name, const Context& context) -> Vector<String>
         { return context.selections() |
                      transform([&](const Selection& s) -> String {
                          return to_string(char_length(context.buffer(), s));
-                     }) | gather<Vector<String>>(); }
+                     }) | gather<Vector<String>>(); },
+        true
     }, {
         "selection_count", false,
         [](StringView name, const Context& context) -> Vector<String>
-        { return {to_string(context.selections().size())}; }
+        { return {to_string(context.selections().size())}; },
+        true
     }, {
         "window_width", false,
         [](StringView name, const Context& context) -> Vector<String>
@@ -444,6 +463,36 @@ void check_timeout(const int& timeout)
         throw runtime_error{"the minimum acceptable timeout is 50 milliseconds"};
 }
 
+void check_idle_highlight_budget(const int& budget)
+{
+    if (budget < 0)
+        throw runtime_error{"idle highlight budget must be positive or zero"};
+}
+
+void check_redraw_interval(const int& interval)
+{
+    if (interval < 0)
+        throw runtime_error{"redraw interval must be positive or zero"};
+}
+
+void check_long_line_margin(const int& margin)
+{
+    if (margin < 0)
+        throw runtime_error{"long line margin must be positive or zero"};
+}
+
+void check_shell_pool_size(const int& size)
+{
+    if (size < 0)
+        throw runtime_error{"shell pool size must be positive or zero"};
+}
+
+void check_shell_cache_timeout(const int& timeout)
+{
+    if (timeout < 0)
+        throw runtime_error{"shell cache timeout must be positive or zero"};
+}
+
 void check_extra_word_chars(const Vector<Codepoint, MemoryDomain::Options>& extra_chars)
 {
     if (any_of(extra_chars, is_blank))
@@ -510,6 +559,21 @@ void register_options()
     reg.declare_option<int, check_timeout>(
         "fs_check_timeout", "timeout, in milliseconds, between file system buffer modification checks",
         500);
+    reg.declare_option<int, check_idle_highlight_budget>(
+        "idle_highlight_budget", "time, in milliseconds, spent highlighting the screens around the displayed one when idle",
+        0);
+    reg.declare_option<int, check_redraw_interval>(
+        "redraw_interval", "minimum time, in milliseconds, between two redraws not caused by the client input, 0 to disable",
+        16);
+    reg.declare_option<int, check_long_line_margin>(
+        "long_line_margin", "bytes around the visible part of long lines given to highlighters, 0 to disable",
+        4096);
+    reg.declare_option<int, check_shell_pool_size>(
+        "shell_pool_size", "number of persistent shells used to evaluate shell scripts, 0 to disable",
+        0);
+    reg.declare_option<int, check_shell_cache_timeout>(
+        "shell_cache_timeout", "milliseconds during which %sh{...} outputs are reused, 0 to disable",
+        0);
     reg.declare_option("ui_options",
                        "space separated list of <key>=<value> options that are "
                        "passed to and interpreted by the user interface\n"
@@ -552,6 +616,7 @@ enum class UIType
 {
     Terminal,
     Json,
+    Msgpack,
     Dummy,
 };
 
@@ -559,6 +624,7 @@ UIType parse_ui_type(StringView ui_name)
 {
     if (ui_name == "terminal") return UIType::Terminal;
     if (ui_name == "json") return UIType::Json;
+    if (ui_name == "msgpack") return UIType::Msgpack;
     if (ui_name == "dummy") return UIType::Dummy;
 
     throw parameter_error(format("error: unknown ui type: '{}'", ui_name));
@@ -591,6 +657,7 @@ UniquePtr<UserInterface> make_ui(UIType ui_type)
     {
         case UIType::Terminal: return make_unique_ptr<TerminalUI>();
         case UIType::Json: return make_unique_ptr<JsonUI>();
+        case UIType::Msgpack: return make_unique_ptr<JsonUI>(JsonUI::Encoding::MessagePack);
         case UIType::Dummy: return make_unique_ptr<DummyUI>();
     }
     throw logic_error{};
@@ -598,6 +665,9 @@ UniquePtr<UserInterface> make_ui(UIType ui_type)
 
 pid_t fork_server_to_background()
 {
+    // only the forking thread survives in the child
+    WorkerPool::instance().stop_workers();
+
     if (pid_t pid = fork())
         return pid;
 
@@ -605,6 +675,10 @@ pid_t fork_server_to_background()
     if (fork()) // double fork to orphan the server
         exit(0);
 
+    EventManager::instance().reset_after_fork();
+    WorkerPool::instance().reset_after_fork();
+    ShellManager::instance().reset_after_fork();
+
     write_stderr(format("Kakoune forked server to background ({}), for session '{}'\n",
                         getpid(), Server::instance().session()));
     return 0;
@@ -635,7 +709,7 @@ int run_client(StringView session, StringView name, StringView client_init,
     try
     {
         Optional<int> stdin_fd;
-        // json-ui (or dummy) is not intended to be user interactive.
+        // json-ui (or msgpack, or dummy) is not intended to be user interactive.
         // So only worry about making the tty your stdin if:
         // (a) ui_type is Terminal, *and*
         // (b) fd 0 is not interactive.
@@ -711,6 +785,7 @@ int run_server(StringView session, StringView server_init,
     SharedHighlighters  defined_highlighters;
     ClientManager       client_manager;
     BufferManager       buffer_manager;
+    WorkerPool          worker_pool;
 
     register_options();
     register_registers();
@@ -1035,7 +1110,7 @@ int main(int argc, char* argv[])
                    { "f", { ArgCompleter{},  "filter: for each file, select the entire buffer and execute the given keys" } },
                    { "i", { ArgCompleter{}, "backup the files on which a filter is applied using the given suffix" } },
                    { "q", { {}, "in filter mode, be quiet about errors applying keys" } },
-                   { "ui", { ArgCompleter{}, "set the type of user interface to use (terminal, dummy, or json)" } },
+                   { "ui", { ArgCompleter{}, "set the type of user interface to use (terminal, dummy, json or msgpack)" } },
                    { "l", { {}, "list existing sessions" } },
                    { "clear", { {}, "clear dead sessions" } },
                    { "debug", { ArgCompleter{}, "initial debug option value" } },
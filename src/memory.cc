@@ -4,5 +4,6 @@ namespace Kakoune
 {
 
 MemoryStats memory_stats[(size_t)MemoryDomain::Count] = {};
+thread_local constinit MemoryStats* thread_memory_stats = memory_stats;
 
 }
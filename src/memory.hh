@@ -82,9 +82,14 @@ struct MemoryStats
 
 extern MemoryStats memory_stats[(size_t)MemoryDomain::Count];
 
+// Stats updated by the current thread, worker threads count their
+// allocations separately and have them merged by the main thread. Workers
+// only free what they allocated, so their stats never go below zero either.
+extern thread_local constinit MemoryStats* thread_memory_stats;
+
 inline void on_alloc(MemoryDomain domain, size_t size)
 {
-    auto& stats = memory_stats[(int)domain];
+    auto& stats = thread_memory_stats[(int)domain];
     stats.allocated_bytes += size;
     ++stats.allocation_count;
     ++stats.total_allocation_count;
@@ -92,7 +97,7 @@ inline void on_alloc(MemoryDomain domain, size_t size)
 
 inline void on_dealloc(MemoryDomain domain, size_t size)
 {
-    auto& stats = memory_stats[(int)domain];
+    auto& stats = thread_memory_stats[(int)domain];
     kak_assert(stats.allocated_bytes >= size);
     stats.allocated_bytes -= size;
     --stats.allocation_count;
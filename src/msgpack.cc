@@ -0,0 +1,173 @@
+#include "msgpack.hh"
+
+#include "exception.hh"
+#include "format.hh"
+#include "unit_tests.hh"
+
+#include <climits>
+
+namespace Kakoune
+{
+
+static constexpr size_t max_parsing_depth = 100;
+
+static JsonResult parse_msgpack_impl(const char* pos, const char* end, size_t depth)
+{
+    if (pos == end)
+        return {};
+
+    if (depth >= max_parsing_depth)
+        throw runtime_error("maximum parsing depth reached");
+
+    const unsigned char tag = *pos++;
+
+    auto has_bytes = [&](uint32_t size) { return (uint32_t)(end - pos) >= size; };
+    auto read_uint = [&](int size) {
+        uint32_t value = 0;
+        for (int i = 0; i < size; ++i)
+            value = (value << 8) | (unsigned char)*pos++;
+        return value;
+    };
+
+    auto parse_string = [&](uint32_t length) -> JsonResult {
+        if (not has_bytes(length))
+            return {};
+        return {String{pos, pos + length}, pos + length};
+    };
+
+    auto parse_array = [&](uint32_t size) -> JsonResult {
+        JsonArray array;
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            auto [element, new_pos] = parse_msgpack_impl(pos, end, depth+1);
+            if (not element)
+                return {};
+            pos = new_pos;
+            array.push_back(std::move(element));
+        }
+        return {std::move(array), pos};
+    };
+
+    auto parse_map = [&](uint32_t size) -> JsonResult {
+        JsonObject object;
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            auto [name, name_end] = parse_msgpack_impl(pos, end, depth+1);
+            if (not name)
+                return {};
+            if (not name.is_a<String>())
+                throw runtime_error("msgpack map keys must be strings");
+            auto [element, element_end] = parse_msgpack_impl(name_end, end, depth+1);
+            if (not element)
+                return {};
+            pos = element_end;
+            object.insert({std::move(name.as<String>()), std::move(element)});
+        }
+        return {std::move(object), pos};
+    };
+
+    // sized types, with the size of their length or value following the tag
+    auto sized = [&](int size, auto&& parse) -> JsonResult {
+        if (not has_bytes(size))
+            return {};
+        return parse(read_uint(size));
+    };
+    auto to_int = [&](uint32_t value) -> JsonResult {
+        if (value > INT_MAX)
+            throw runtime_error("msgpack integer too big");
+        return {Value{(int)value}, pos};
+    };
+
+    if (tag <= 0x7f)
+        return {Value{(int)tag}, pos};
+    if (tag >= 0xe0)
+        return {Value{(int)(int8_t)tag}, pos};
+    if ((tag & 0xe0) == 0xa0)
+        return parse_string(tag & 0x1f);
+    if ((tag & 0xf0) == 0x90)
+        return parse_array(tag & 0x0f);
+    if ((tag & 0xf0) == 0x80)
+        return parse_map(tag & 0x0f);
+
+    switch (tag)
+    {
+        case 0xc2: return {Value{false}, pos};
+        case 0xc3: return {Value{true}, pos};
+        case 0xcc: return sized(1, to_int);
+        case 0xcd: return sized(2, to_int);
+        case 0xce: return sized(4, to_int);
+        case 0xd0: return sized(1, [&](uint32_t value) -> JsonResult { return {Value{(int)(int8_t)value}, pos}; });
+        case 0xd1: return sized(2, [&](uint32_t value) -> JsonResult { return {Value{(int)(int16_t)value}, pos}; });
+        case 0xd2: return sized(4, [&](uint32_t value) -> JsonResult { return {Value{(int)(int32_t)value}, pos}; });
+        case 0xd9: return sized(1, parse_string);
+        case 0xda: return sized(2, parse_string);
+        case 0xdb: return sized(4, parse_string);
+        case 0xdc: return sized(2, parse_array);
+        case 0xdd: return sized(4, parse_array);
+        case 0xde: return sized(2, parse_map);
+        case 0xdf: return sized(4, parse_map);
+    }
+    throw runtime_error(format("unsupported msgpack type 0x{:02}", hex(tag)));
+}
+
+JsonResult parse_msgpack(const char* pos, const char* end) { return parse_msgpack_impl(pos, end, 0); }
+
+UnitTest test_msgpack{[]()
+{
+    struct Writer
+    {
+        void write(StringView str) { data += str; }
+        String data;
+    };
+
+    auto round_trip = [](auto&& value) {
+        Writer writer;
+        write_msgpack(writer, value);
+        auto [parsed, end] = parse_msgpack(writer.data.begin(), writer.data.end());
+        kak_assert(end == writer.data.end());
+        // no prefix of the encoding should parse
+        for (auto prefix_end = writer.data.begin(); prefix_end != writer.data.end(); ++prefix_end)
+            kak_assert(not parse_msgpack(writer.data.begin(), prefix_end).value);
+        return std::move(parsed);
+    };
+
+    for (int i : {0, 1, 127, 128, 255, 256, -1, -32, -33, -128, -129, 32767, 32768, -32768, -32769, INT_MAX, INT_MIN})
+        kak_assert(round_trip(i).as<int>() == i);
+
+    kak_assert(round_trip(true).as<bool>() == true);
+    kak_assert(round_trip(false).as<bool>() == false);
+
+    for (int length : {0, 31, 32, 255, 256, 65535, 65536})
+    {
+        String str{'a', CharCount{length}};
+        kak_assert(round_trip(StringView{str}).as<String>() == str);
+    }
+
+    for (size_t size : {0, 15, 16, 65536})
+    {
+        Writer writer;
+        write_msgpack_array(writer, size);
+        for (size_t i = 0; i < size; ++i)
+            write_msgpack(writer, (int)i);
+        write_msgpack_map(writer, size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            write_msgpack(writer, StringView{to_string(i)});
+            write_msgpack(writer, (int)i);
+        }
+
+        auto [array, array_end] = parse_msgpack(writer.data.begin(), writer.data.end());
+        kak_assert(array.as<JsonArray>().size() == size);
+        kak_assert(size == 0 or array.as<JsonArray>().back().as<int>() == (int)size-1);
+
+        auto [map, map_end] = parse_msgpack(array_end, writer.data.end());
+        kak_assert(map_end == writer.data.end());
+        kak_assert(map.as<JsonObject>().size() == size);
+        kak_assert(size == 0 or map.as<JsonObject>().get(StringView{to_string(size-1)}).as<int>() == (int)size-1);
+    }
+
+    const char unsupported[] = "\xc0";
+    kak_expect_throw(runtime_error, parse_msgpack(unsupported, unsupported + 1));
+}};
+
+}
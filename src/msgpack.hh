@@ -0,0 +1,88 @@
+#ifndef msgpack_hh_INCLUDED
+#define msgpack_hh_INCLUDED
+
+#include "json.hh"
+#include "string.hh"
+
+#include <cstdint>
+
+namespace Kakoune
+{
+
+// MessagePack (https://msgpack.org) encoding, values are decoded to the
+// same representation as parsed json, maps being decoded as JsonObject.
+
+namespace detail
+{
+
+template<typename Writer>
+void write_msgpack_tag(Writer& writer, unsigned char tag, uint32_t value, int size)
+{
+    char buffer[5] = { (char)tag };
+    for (int i = 0; i < size; ++i)
+        buffer[1+i] = (char)(value >> (8 * (size - 1 - i)));
+    writer.write({buffer, buffer + 1 + size});
+}
+
+template<typename Writer>
+void write_msgpack_header(Writer& writer, size_t size, unsigned char fix_tag, size_t fix_max,
+                          unsigned char tag16, unsigned char tag32)
+{
+    if (size <= fix_max)
+        write_msgpack_tag(writer, fix_tag | (unsigned char)size, 0, 0);
+    else if (size <= UINT16_MAX)
+        write_msgpack_tag(writer, tag16, size, 2);
+    else
+        write_msgpack_tag(writer, tag32, size, 4);
+}
+
+}
+
+template<typename Writer>
+void write_msgpack(Writer& writer, bool b)
+{
+    detail::write_msgpack_tag(writer, b ? 0xc3 : 0xc2, 0, 0);
+}
+
+template<typename Writer>
+void write_msgpack(Writer& writer, int i)
+{
+    if (i >= -32 and i <= 127)
+        detail::write_msgpack_tag(writer, (unsigned char)i, 0, 0);
+    else if (i >= INT16_MIN and i <= INT16_MAX)
+        detail::write_msgpack_tag(writer, 0xd1, (uint16_t)i, 2);
+    else
+        detail::write_msgpack_tag(writer, 0xd2, (uint32_t)i, 4);
+}
+
+template<typename Writer>
+void write_msgpack(Writer& writer, StringView str)
+{
+    const size_t length = (size_t)(int)str.length();
+    if (length <= 31)
+        detail::write_msgpack_tag(writer, 0xa0 | (unsigned char)length, 0, 0);
+    else if (length <= UINT8_MAX)
+        detail::write_msgpack_tag(writer, 0xd9, length, 1);
+    else
+        detail::write_msgpack_header(writer, length, 0, 0, 0xda, 0xdb);
+    writer.write(str);
+}
+
+template<typename Writer>
+void write_msgpack_array(Writer& writer, size_t size)
+{
+    detail::write_msgpack_header(writer, size, 0x90, 15, 0xdc, 0xdd);
+}
+
+template<typename Writer>
+void write_msgpack_map(Writer& writer, size_t size)
+{
+    detail::write_msgpack_header(writer, size, 0x80, 15, 0xde, 0xdf);
+}
+
+// returns an empty value and a null position if the data is incomplete
+JsonResult parse_msgpack(const char* pos, const char* end);
+
+}
+
+#endif // msgpack_hh_INCLUDED
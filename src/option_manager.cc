@@ -95,6 +95,7 @@ void OptionManager::unset_option(StringView name)
     {
         auto& parent_option = (*m_parent)[name];
         const bool changed = not parent_option.has_same_value(*it->value);
+        ++Option::s_generation;
         GlobalScope::instance().option_registry().move_to_trash(std::move(it->value));
         m_options.erase(name);
         if (changed)
@@ -71,11 +71,23 @@ public:
     const String& docstring() const { return m_desc.docstring(); }
     OptionFlags flags() const { return m_desc.flags(); }
 
+    // changes whenever any option value might have changed, so that values
+    // derived from options can be cached
+    static size_t generation() { return s_generation; }
+    // changes whenever this option value might have changed, unique across options
+    size_t version() const { return m_version; }
+
 protected:
+    friend class OptionManager;
     Option(const OptionDesc& desc, OptionManager& manager);
 
+    void value_changed() { m_version = ++s_generation; }
+
     OptionManager& m_manager;
     const OptionDesc& m_desc;
+
+    static inline size_t s_generation = 0;
+    size_t m_version = ++s_generation;
 };
 
 class OptionManager final : private OptionWatcher
@@ -136,12 +148,13 @@ public:
         if (m_value != value)
         {
             m_value = std::move(value);
+            value_changed();
             if (notify)
                 manager().on_option_changed(*this);
         }
     }
     const T& get() const { return m_value; }
-    T& get_mutable() { return m_value; }
+    T& get_mutable() { value_changed(); return m_value; }
 
     Vector<String> get_as_strings() const override
     {
@@ -169,18 +182,25 @@ public:
     void add_from_strings(ConstArrayView<String> strs) override
     {
         if (option_add_from_strings(m_value, strs))
+        {
+            value_changed();
             m_manager.on_option_changed(*this);
+        }
     }
 
     void remove_from_strings(ConstArrayView<String> strs) override
     {
         if (option_remove_from_strings(m_value, strs))
+        {
+            value_changed();
             m_manager.on_option_changed(*this);
+        }
     }
 
     void update(const Context& context) override
     {
         option_update(m_value, context);
+        value_changed();
     }
 
     bool has_same_value(const Option& other) const override
@@ -216,6 +236,7 @@ template<typename T> const T& Option::get() const
 
 template<typename T> T& Option::get_mutable()
 {
+    value_changed();
     return const_cast<T&>(get<T>());
 }
 
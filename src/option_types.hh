@@ -409,6 +409,33 @@ inline bool option_remove_from_strings(PrefixedList<P, T>& opt, ConstArrayView<S
     return option_remove_from_strings(opt.list, str);
 }
 
+// Elements added to or removed from a timestamped list can be preceded by
+// the timestamp they refer to, which must then match the list timestamp
+template<typename T>
+ConstArrayView<String> check_timestamp(const TimestampedList<T>& opt, ConstArrayView<String> strs)
+{
+    if (strs.empty() or contains(strs[0], '|'))
+        return strs;
+
+    const size_t timestamp = str_to_int(strs[0]);
+    if (timestamp != opt.prefix)
+        throw runtime_error(format("timestamp {} does not match the option timestamp {}",
+                                   timestamp, opt.prefix));
+    return strs.subrange(1);
+}
+
+template<typename T>
+inline bool option_add_from_strings(TimestampedList<T>& opt, ConstArrayView<String> strs)
+{
+    return option_add_from_strings(opt.list, check_timestamp(opt, strs));
+}
+
+template<typename T>
+inline bool option_remove_from_strings(TimestampedList<T>& opt, ConstArrayView<String> strs)
+{
+    return option_remove_from_strings(opt.list, check_timestamp(opt, strs));
+}
+
 }
 
 #endif // option_types_hh_INCLUDED
@@ -0,0 +1,165 @@
+#include "profile.hh"
+
+#include "array.hh"
+#include "format.hh"
+#include "hash_map.hh"
+#include "ranges.hh"
+#include "unit_tests.hh"
+
+#include <algorithm>
+#include <bit>
+
+namespace Kakoune
+{
+
+namespace
+{
+
+using std::chrono::microseconds;
+
+struct ProfileStats
+{
+    void add(microseconds duration, microseconds shell_duration)
+    {
+        ++count;
+        total += duration;
+        max = std::max(max, duration);
+        shell += shell_duration;
+        ++histogram[bucket(duration.count())];
+    }
+
+    // approximated by the upper bound of the histogram bucket it falls in
+    microseconds percentile(size_t percent) const
+    {
+        const size_t target = (count * percent + 99) / 100;
+        size_t seen = 0;
+        for (size_t i = 0; i < histogram.size(); ++i)
+        {
+            if ((seen += histogram[i]) >= target)
+                return std::min(microseconds{bucket_max(i)}, max);
+        }
+        return max;
+    }
+
+    // durations below 4us get their own bucket, each power of two above
+    // is split in 4 buckets, so percentiles are within 25% of the real ones
+    static size_t bucket(uint64_t us)
+    {
+        if (us < 4)
+            return us;
+        const int exponent = std::bit_width(us) - 1;
+        return 4 * (exponent - 1) + ((us >> (exponent - 2)) & 3);
+    }
+
+    static uint64_t bucket_max(size_t index)
+    {
+        if (index < 4)
+            return index;
+        const int exponent = index / 4 + 1;
+        return ((5 + index % 4) << (exponent - 2)) - 1;
+    }
+
+    size_t count = 0;
+    microseconds total{};
+    microseconds max{};
+    microseconds shell{};
+    Array<uint32_t, 4 * 64> histogram{};
+};
+
+HashMap<String, ProfileStats> profile_stats;
+microseconds profiled_shell_time{};
+
+}
+
+ProfileReportScope::ProfileReportScope(const DebugFlags debug_flags, StringView kind, StringView name, StringView group)
+    : m_start_time{}, m_start_shell_time{}
+{
+    if (not (debug_flags & DebugFlags::ProfileReport))
+        return;
+
+    m_key = group.empty() ? format("{} {}", kind, name) : format("{} {}/{}", kind, name, group);
+    m_start_time = Clock::now();
+    m_start_shell_time = profiled_shell_time;
+}
+
+ProfileReportScope::~ProfileReportScope()
+{
+    if (m_key.empty())
+        return;
+
+    using namespace std::chrono;
+    profile_stats[m_key].add(duration_cast<microseconds>(Clock::now() - m_start_time),
+                             profiled_shell_time - m_start_shell_time);
+}
+
+void add_profiled_shell_time(microseconds duration)
+{
+    profiled_shell_time += duration;
+}
+
+void write_profile_report(StringView sort_column)
+{
+    using Stat = microseconds (*)(const ProfileStats&);
+    struct Column { StringView name; Stat stat; };
+    static constexpr Column columns[] = {
+        { "count", [](const ProfileStats& s) { return microseconds{s.count}; } },
+        { "total", [](const ProfileStats& s) { return s.total; } },
+        { "max",   [](const ProfileStats& s) { return s.max; } },
+        { "p99",   [](const ProfileStats& s) { return s.percentile(99); } },
+        { "shell", [](const ProfileStats& s) { return s.shell; } },
+    };
+
+    Vector<const decltype(profile_stats)::Item*> entries;
+    for (auto& entry : profile_stats)
+        entries.push_back(&entry);
+
+    if (sort_column == "name")
+        std::sort(entries.begin(), entries.end(), [](auto* lhs, auto* rhs) { return lhs->key < rhs->key; });
+    else
+    {
+        auto column = find_if(columns, [&](const Column& c) { return c.name == sort_column; });
+        if (column == std::end(columns))
+            throw runtime_error(format("no such profile report column: '{}'", sort_column));
+        std::stable_sort(entries.begin(), entries.end(), [stat = column->stat](auto* lhs, auto* rhs) {
+            return stat(lhs->value) > stat(rhs->value);
+        });
+    }
+
+    write_to_debug_buffer(format("Profile report (sorted by {}, durations in us):", sort_column));
+    write_to_debug_buffer(format("{:10} │{:12} │{:10} │{:10} │{:12} │ name",
+                                 "count", "total", "max", "p99", "shell"));
+    for (auto* entry : entries)
+    {
+        auto& stats = entry->value;
+        write_to_debug_buffer(format("{:10} │{:12} │{:10} │{:10} │{:12} │ {}",
+                                     grouped(stats.count), grouped(stats.total.count()),
+                                     grouped(stats.max.count()), grouped(stats.percentile(99).count()),
+                                     grouped(stats.shell.count()), entry->key));
+    }
+}
+
+void reset_profile_report()
+{
+    profile_stats.clear();
+}
+
+UnitTest test_profile_stats{[]()
+{
+    for (uint64_t us : {0, 1, 3, 4, 5, 7, 8, 100, 1000, 123456789})
+    {
+        auto bucket = ProfileStats::bucket(us);
+        kak_assert(ProfileStats::bucket_max(bucket) >= us);
+        kak_assert(bucket == 0 or ProfileStats::bucket_max(bucket - 1) < us);
+    }
+
+    ProfileStats stats;
+    for (int i = 0; i < 99; ++i)
+        stats.add(microseconds{10}, {});
+    stats.add(microseconds{10000}, microseconds{5});
+    kak_assert(stats.count == 100 and stats.total.count() == 10990);
+    kak_assert(stats.max.count() == 10000 and stats.shell.count() == 5);
+    kak_assert(stats.percentile(99).count() == 11);
+    kak_assert(stats.percentile(100).count() == 10000);
+}};
+
+}
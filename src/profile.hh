@@ -4,6 +4,8 @@
 #include "clock.hh"
 #include "context.hh"
 #include "debug.hh"
+#include "flags.hh"
+#include "string.hh"
 
 namespace Kakoune
 {
@@ -30,6 +32,28 @@ private:
     Callback m_callback;
 };
 
+// Adds the time spent in its scope, and in shell commands run meanwhile,
+// to the '<kind> <name>[/<group>]' entry of the profile report
+class ProfileReportScope
+{
+public:
+    ProfileReportScope(const DebugFlags debug_flags, StringView kind, StringView name, StringView group = {});
+    ~ProfileReportScope();
+
+private:
+    String m_key;
+    Clock::time_point m_start_time;
+    std::chrono::microseconds m_start_shell_time;
+};
+
+// shell commands report the time they took, to be attributed to the
+// profiled scopes running them
+void add_profiled_shell_time(std::chrono::microseconds duration);
+
+// writes the profile report in the debug buffer, sorted by the given column
+void write_profile_report(StringView sort_column);
+void reset_profile_report();
+
 }
 
 #endif // profile_hh_INCLUDED
@@ -7,12 +7,15 @@
 #include "display_buffer.hh"
 #include "event_manager.hh"
 #include "file.hh"
+#include "flags.hh"
 #include "hash_map.hh"
 #include "optional.hh"
 #include "user_interface.hh"
 #include "ranges.hh"
+#include "unit_tests.hh"
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/wait.h>
@@ -23,6 +26,8 @@
 #include <fcntl.h>
 #include <errno.h>
 
+#include <atomic>
+
 
 namespace Kakoune
 {
@@ -44,13 +49,38 @@ enum class MessageType : uint8_t
     Exit,
     Key,
     Paste,
+    DrawDelta,
+    Features,
+    SharedDraw,
 };
 
+// Protocol extensions supported by the client, sent at the end of the connect
+// message so that servers unaware of them still accept the connection
+enum class ProtocolFeatures : uint32_t
+{
+    None      = 0,
+    DrawDelta = 1 << 0, // client can patch its last frame with changed lines
+    FaceTable = 1 << 1, // faces are referenced by ids defined on first use
+    SharedFrames = 1 << 2, // frames are written in memory shared with the client
+    Supported = DrawDelta | FaceTable | SharedFrames
+};
+
+constexpr bool with_bit_ops(Meta::Type<ProtocolFeatures>) { return true; }
+
+// With the FaceTable feature, a face is written as its id in the table of
+// faces already sent, followed by the face itself when the id is new (equal
+// to the table size), or when the table is full (literal_face_id).
+using FaceIds = HashMap<Face, uint16_t, MemoryDomain::Remote>;
+constexpr uint16_t literal_face_id = (uint16_t)-1;
+constexpr size_t max_face_ids = 4096;
+
+constexpr size_t max_queued_data = 1024 * 1024;
+
 class MsgWriter
 {
 public:
-    MsgWriter(RemoteBuffer& buffer, MessageType type)
-        : m_buffer{buffer}, m_start{(uint32_t)buffer.size()}
+    MsgWriter(RemoteBuffer& buffer, MessageType type, FaceIds* face_ids = nullptr)
+        : m_buffer{buffer}, m_start{(uint32_t)buffer.size()}, m_face_ids{face_ids}
     {
         write_field(type);
         write_field((uint32_t)0); // message size, to be patched on write
@@ -136,6 +166,25 @@ private:
         }
     }
 
+    void write_field(const Face& face)
+    {
+        if (not m_face_ids)
+            return write_raw((const char*)&face, sizeof(face));
+
+        if (auto it = m_face_ids->find(face); it != m_face_ids->end())
+            return write_field(it->value);
+
+        if (m_face_ids->size() < max_face_ids)
+        {
+            const uint16_t id = m_face_ids->size();
+            m_face_ids->insert({face, id});
+            write_field(id);
+        }
+        else
+            write_field(literal_face_id);
+        write_raw((const char*)&face, sizeof(face));
+    }
+
     void write_field(const DisplayAtom& atom)
     {
         write_field(atom.content());
@@ -155,6 +204,7 @@ private:
 private:
     RemoteBuffer& m_buffer;
     uint32_t m_start;
+    FaceIds* m_face_ids;
 };
 
 class MsgReader
@@ -265,6 +315,26 @@ public:
         return Reader<T>::read(*this);
     }
 
+    bool at_end() const
+    {
+        return m_read_pos == m_stream.size();
+    }
+
+    void enable_face_table()
+    {
+        m_use_face_table = true;
+    }
+
+    // Use a message that was not received through the socket
+    void load(RemoteBuffer message)
+    {
+        m_stream = std::move(message);
+        m_write_pos = m_stream.size();
+        m_read_pos = header_size;
+        if (m_write_pos < header_size or size() != m_write_pos)
+            throw disconnected{"invalid message loaded"};
+    }
+
     Optional<int> ancillary_fd()
     {
         auto res = m_ancillary_fd;
@@ -314,10 +384,12 @@ private:
     }
 
     static constexpr uint32_t header_size = sizeof(MessageType) + sizeof(uint32_t);
-    Vector<char, MemoryDomain::Remote> m_stream;
+    RemoteBuffer m_stream;
     Optional<int> m_ancillary_fd;
     uint32_t m_write_pos = 0;
     uint32_t m_read_pos = header_size;
+    bool m_use_face_table = false;
+    Vector<Face, MemoryDomain::Remote> m_face_table;
 };
 
 template<>
@@ -351,6 +423,33 @@ struct MsgReader::Reader<Color> {
     }
 };
 
+template<>
+struct MsgReader::Reader<Face> {
+    static Face read(MsgReader& reader)
+    {
+        auto read_face = [&] {
+            Face res;
+            reader.read(reinterpret_cast<char*>(&res), sizeof(Face));
+            return res;
+        };
+
+        if (not reader.m_use_face_table)
+            return read_face();
+
+        auto& table = reader.m_face_table;
+        const auto id = Reader<uint16_t>::read(reader);
+        if (id < table.size())
+            return table[id];
+        if (id != table.size() and id != literal_face_id)
+            throw disconnected{"invalid face id received"};
+
+        Face res = read_face();
+        if (id == table.size())
+            table.push_back(res);
+        return res;
+    }
+};
+
 template<>
 struct MsgReader::Reader<DisplayAtom> {
     static DisplayAtom read(MsgReader& reader)
@@ -378,11 +477,148 @@ struct MsgReader::Reader<DisplayBuffer> {
     }
 };
 
+// Features are missing from the connect message of clients predating them
+static ProtocolFeatures read_features(MsgReader& reader)
+{
+    return reader.at_end() ? ProtocolFeatures::None : reader.read<ProtocolFeatures>();
+}
+
+// Writes the line count of a frame and its lines that changed since the last
+// one, whose serialized lines are kept in last_lines.
+static void write_changed_lines(MsgWriter& msg, const DisplayLineList& lines,
+                                Vector<RemoteBuffer, MemoryDomain::Remote>& last_lines)
+{
+    Vector<uint32_t, MemoryDomain::Remote> changed;
+    last_lines.resize(lines.size());
+    for (uint32_t i = 0; i < lines.size(); ++i)
+    {
+        RemoteBuffer line_data; // written without face ids, which would be registered
+        MsgWriter{line_data, MessageType::Unknown}.write(lines[i]);
+        if (line_data != last_lines[i])
+        {
+            last_lines[i] = std::move(line_data);
+            changed.push_back(i);
+        }
+    }
+
+    msg.write((uint32_t)lines.size(), (uint32_t)changed.size());
+    for (auto i : changed)
+        msg.write(i, lines[i]);
+}
+
+// Reads the lines of a Draw message, or patches the ones of the last frame
+// with the lines of a DrawDelta message.
+static void read_lines(MsgReader& reader, DisplayBuffer& display_buffer)
+{
+    if (reader.type() == MessageType::Draw)
+    {
+        display_buffer = reader.read<DisplayBuffer>();
+        return;
+    }
+
+    auto& lines = display_buffer.lines();
+    lines.resize(reader.read<uint32_t>());
+    for (auto count = reader.read<uint32_t>(); count > 0; --count)
+    {
+        auto index = reader.read<uint32_t>();
+        if (index >= lines.size())
+            throw disconnected{"invalid draw delta received"};
+        lines[index] = reader.read<DisplayLine>();
+    }
+}
+
+// Memory shared between the server and a client on the same host, holding
+// two frame slots. The server only writes a frame to a slot that is not
+// marked ready, then marks it ready and notifies the client through the
+// socket. The client copies the frame out and marks the slot free again.
+// Frames that do not find a free slot big enough are sent on the socket.
+class SharedFrames
+{
+public:
+    static constexpr size_t slot_size = 1024 * 1024;
+
+    static int create_fd()
+    {
+#if defined(__linux__)
+        int fd = memfd_create("kakoune-frames", MFD_CLOEXEC);
+#else
+        static int count = 0;
+        String name = format("/kakoune-frames-{}-{}", getpid(), count++);
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd != -1)
+        {
+            shm_unlink(name.c_str());
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if (fd == -1 or ftruncate(fd, mapping_size) != 0)
+        {
+            if (fd != -1)
+                close(fd);
+            throw runtime_error(format("unable to create shared frames: {}", strerror(errno)));
+        }
+        return fd;
+    }
+
+    SharedFrames(int fd) : m_fd{fd}
+    {
+        void* data = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            throw runtime_error(format("unable to map shared frames: {}", strerror(errno)));
+        }
+        m_data = static_cast<char*>(data);
+    }
+
+    ~SharedFrames()
+    {
+        munmap(m_data, mapping_size);
+        close(m_fd);
+    }
+
+    int fd() const { return m_fd; }
+
+    Optional<uint32_t> write(const RemoteBuffer& frame)
+    {
+        if (frame.size() > slot_size)
+            return {};
+        for (uint32_t slot : {0u, 1u})
+        {
+            if (ready(slot).load(std::memory_order_acquire))
+                continue;
+            memcpy(m_data + slot_offset(slot), frame.data(), frame.size());
+            ready(slot).store(1, std::memory_order_release);
+            return slot;
+        }
+        return {};
+    }
+
+    RemoteBuffer read(uint32_t slot, uint32_t size)
+    {
+        if (slot > 1 or size > slot_size or not ready(slot).load(std::memory_order_acquire))
+            throw disconnected{"invalid shared frame received"};
+        const char* data = m_data + slot_offset(slot);
+        RemoteBuffer frame(data, data + size);
+        ready(slot).store(0, std::memory_order_release);
+        return frame;
+    }
+
+private:
+    static constexpr size_t header_size = 64;
+    static constexpr size_t mapping_size = header_size + 2 * slot_size;
+
+    static size_t slot_offset(uint32_t slot) { return header_size + slot * slot_size; }
+    std::atomic<uint32_t>& ready(uint32_t slot) { return reinterpret_cast<std::atomic<uint32_t>*>(m_data)[slot]; }
+
+    int m_fd;
+    char* m_data;
+};
 
 class RemoteUI : public UserInterface
 {
 public:
-    RemoteUI(int socket, DisplayCoord dimensions);
+    RemoteUI(int socket, DisplayCoord dimensions, ProtocolFeatures features);
     ~RemoteUI() override;
 
     bool is_ok() const override { return m_socket_watcher.fd() != -1; }
@@ -420,6 +656,9 @@ public:
     void set_on_paste(OnPasteCallback callback) override
     { m_on_paste = std::move(callback); }
 
+    void set_on_redraw(OnRedrawCallback callback) override
+    { m_on_redraw = std::move(callback); }
+
     void set_ui_options(const Options& options) override;
 
     void exit(int status);
@@ -428,24 +667,37 @@ private:
     template<typename ...Args>
     void send_message(MessageType type, Args&&... args)
     {
-        MsgWriter msg{m_send_buffer, type};
+        MsgWriter msg{m_send_queue.buffer, type, face_ids()};
         msg.write(std::forward<Args>(args)...);
-        m_socket_watcher.events() |= FdEvents::Write;
+        m_socket_watcher.set_events(m_socket_watcher.events() | FdEvents::Write);
     }
 
+    FaceIds* face_ids() { return m_features & ProtocolFeatures::FaceTable ? &m_face_ids : nullptr; }
+    RemoteBuffer& frame_buffer() { return m_shared_frames ? m_frame_buffer : m_send_queue.buffer; }
+    void send_frame();
+    bool drop_message();
+
     FDWatcher     m_socket_watcher;
     MsgReader     m_reader;
     DisplayCoord  m_dimensions;
     OnKeyCallback m_on_key;
     OnPasteCallback m_on_paste;
-    RemoteBuffer  m_send_buffer;
+    OnRedrawCallback m_on_redraw;
+    SendQueue     m_send_queue;
+    bool          m_messages_dropped = false;
+    ProtocolFeatures m_features;
+    Vector<RemoteBuffer, MemoryDomain::Remote> m_last_lines;
+    FaceIds m_face_ids;
+    UniquePtr<SharedFrames> m_shared_frames;
+    bool m_shared_frames_fd_sent = false;
+    RemoteBuffer m_frame_buffer;
 };
 
-static bool send_data(int fd, RemoteBuffer& buffer, Optional<int> ancillary_fd = {})
+static bool send_data(int fd, SendQueue& queue, Optional<int> ancillary_fd = {})
 {
-    while (not buffer.empty() and fd_writable(fd))
+    while (not queue.empty() and fd_writable(fd))
     {
-        iovec io{buffer.data(), buffer.size()};
+        iovec io{queue.buffer.data() + queue.pos, queue.pending()};
         alignas(cmsghdr) char fdbuf[CMSG_SPACE(sizeof(int))];
 
         msghdr msg{};
@@ -466,19 +718,49 @@ static bool send_data(int fd, RemoteBuffer& buffer, Optional<int> ancillary_fd =
         int res = sendmsg(fd, &msg, 0);
         if (res <= 0)
               throw disconnected{format("socket write failed: {}", strerror(errno))};
-         buffer.erase(buffer.begin(), buffer.begin() + res);
+        queue.pos += res;
+        ancillary_fd.reset(); // sent along the first written bytes
+    }
+
+    // Only drop sent data once it is the larger part of the buffer, so
+    // that moving the remaining data is amortized over the sent one.
+    auto& buffer = queue.buffer;
+    if (queue.pos * 2 > buffer.size())
+    {
+        buffer.erase(buffer.begin(), buffer.begin() + queue.pos);
+        queue.pos = 0;
     }
-    return buffer.empty();
+    return queue.empty();
 }
 
-RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
+RemoteUI::RemoteUI(int socket, DisplayCoord dimensions, ProtocolFeatures features)
     : m_socket_watcher(socket,  FdEvents::Read | FdEvents::Write, EventMode::Urgent,
                        [this](FDWatcher& watcher, FdEvents events, EventMode) {
           const int sock = watcher.fd();
           try
           {
-              if (events & FdEvents::Write and send_data(sock, m_send_buffer))
-                  m_socket_watcher.events() &= ~FdEvents::Write;
+              if (events & FdEvents::Write)
+              {
+                  Optional<int> shared_frames_fd;
+                  if (m_shared_frames and not m_shared_frames_fd_sent)
+                      shared_frames_fd = m_shared_frames->fd();
+                  const size_t pending = m_send_queue.pending();
+                  const bool done = send_data(sock, m_send_queue, shared_frames_fd);
+                  if (m_send_queue.pending() != pending)
+                      m_shared_frames_fd_sent = true;
+
+                  if (done)
+                  {
+                      m_socket_watcher.set_events(m_socket_watcher.events() & ~FdEvents::Write);
+                      // Ask for a full redraw now that the client caught up
+                      // with the data that was sent.
+                      if (m_messages_dropped)
+                      {
+                          m_messages_dropped = false;
+                          m_on_redraw();
+                      }
+                  }
+              }
 
               while (events & FdEvents::Read and fd_readable(sock))
               {
@@ -514,8 +796,27 @@ RemoteUI::RemoteUI(int socket, DisplayCoord dimensions)
               m_socket_watcher.close_fd();
           }
       }),
-      m_dimensions(dimensions)
+      m_dimensions(dimensions),
+      m_features(features & ProtocolFeatures::Supported)
 {
+    if (m_features & ProtocolFeatures::SharedFrames) try
+    {
+        m_shared_frames.reset(new SharedFrames{SharedFrames::create_fd()});
+        // frames are written the same way whichever way they are sent
+        m_features &= ~ProtocolFeatures::FaceTable;
+    }
+    catch (runtime_error& error)
+    {
+        write_to_debug_buffer(error.what());
+        m_features &= ~ProtocolFeatures::SharedFrames;
+    }
+
+    // Let the client know which of its features are used, it cannot tell by
+    // itself if the server is older and ignored them. The shared frames fd
+    // is sent along this first message.
+    if (m_features != ProtocolFeatures::None)
+        send_message(MessageType::Features, m_features);
+
     write_to_debug_buffer(format("remote client connected: {}", m_socket_watcher.fd()));
 }
 
@@ -525,7 +826,7 @@ RemoteUI::~RemoteUI()
     try
     {
         if (m_socket_watcher.fd() != -1)
-            send_data(m_socket_watcher.fd(), m_send_buffer);
+            send_data(m_socket_watcher.fd(), m_send_queue);
     }
     catch (disconnected&)
     {
@@ -535,20 +836,36 @@ RemoteUI::~RemoteUI()
     m_socket_watcher.close_fd();
 }
 
+// Do not queue display messages for a client that does not keep up, a
+// full redraw will be requested once it has received the queued data.
+bool RemoteUI::drop_message()
+{
+    if (m_send_queue.pending() <= max_queued_data)
+        return false;
+    m_messages_dropped = true;
+    return true;
+}
+
 void RemoteUI::menu_show(ConstArrayView<DisplayLine> choices,
                          DisplayCoord anchor, Face fg, Face bg,
                          MenuStyle style)
 {
+    if (drop_message())
+        return;
     send_message(MessageType::MenuShow, choices, anchor, fg, bg, style);
 }
 
 void RemoteUI::menu_select(int selected)
 {
+    if (drop_message())
+        return;
     send_message(MessageType::MenuSelect, selected);
 }
 
 void RemoteUI::menu_hide()
 {
+    if (drop_message())
+        return;
     send_message(MessageType::MenuHide);
 }
 
@@ -556,11 +873,15 @@ void RemoteUI::info_show(const DisplayLine& title, const DisplayLineList& conten
                          DisplayCoord anchor, Face face,
                          InfoStyle style)
 {
+    if (drop_message())
+        return;
     send_message(MessageType::InfoShow, title, content, anchor, face, style);
 }
 
 void RemoteUI::info_hide()
 {
+    if (drop_message())
+        return;
     send_message(MessageType::InfoHide);
 }
 
@@ -570,7 +891,39 @@ void RemoteUI::draw(const DisplayBuffer& display_buffer,
                     const Face& padding_face,
                     ColumnCount widget_columns)
 {
-    send_message(MessageType::Draw, display_buffer, cursor_pos, default_face, padding_face, widget_columns);
+    if (drop_message())
+    {
+        m_last_lines.clear();
+        return;
+    }
+
+    if (not (m_features & ProtocolFeatures::DrawDelta))
+    {
+        MsgWriter{frame_buffer(), MessageType::Draw, face_ids()}.write(
+            display_buffer, cursor_pos, default_face, padding_face, widget_columns);
+        return send_frame();
+    }
+
+    // Only send the lines that changed, the client patches its copy of the last frame
+    {
+        MsgWriter msg{frame_buffer(), MessageType::DrawDelta, face_ids()};
+        write_changed_lines(msg, display_buffer.lines(), m_last_lines);
+        msg.write(cursor_pos, default_face, padding_face, widget_columns);
+    }
+    send_frame();
+}
+
+void RemoteUI::send_frame()
+{
+    if (m_shared_frames)
+    {
+        if (auto slot = m_shared_frames->write(m_frame_buffer))
+            send_message(MessageType::SharedDraw, *slot, (uint32_t)m_frame_buffer.size());
+        else
+            m_send_queue.buffer.insert(m_send_queue.buffer.end(), m_frame_buffer.begin(), m_frame_buffer.end());
+        m_frame_buffer.clear();
+    }
+    m_socket_watcher.set_events(m_socket_watcher.events() | FdEvents::Write);
 }
 
 void RemoteUI::draw_status(const DisplayLine& prompt,
@@ -580,11 +933,15 @@ void RemoteUI::draw_status(const DisplayLine& prompt,
                            const Face& default_face,
                            StatusStyle style)
 {
+    if (drop_message())
+        return;
     send_message(MessageType::DrawStatus, prompt, content, cursor_pos, mode_line, default_face, style);
 }
 
 void RemoteUI::refresh(bool force)
 {
+    if (drop_message())
+        return;
     send_message(MessageType::Refresh, force);
 }
 
@@ -665,28 +1022,32 @@ RemoteClient::RemoteClient(StringView session, StringView name, UniquePtr<UserIn
 {
     int sock = connect_to(session);
 
+    auto features = ProtocolFeatures::Supported;
+    if (StringView shared_frames = getenv("KAKOUNE_SHARED_FRAMES"); shared_frames.empty())
+        features &= ~ProtocolFeatures::SharedFrames;
     {
-        MsgWriter msg{m_send_buffer, MessageType::Connect};
-        msg.write(pid, name, init_command, init_coord, m_ui->dimensions(), env_vars);
+        MsgWriter msg{m_send_queue.buffer, MessageType::Connect};
+        msg.write(pid, name, init_command, init_coord, m_ui->dimensions(), env_vars, features);
     }
-    send_data(sock, m_send_buffer, stdin_fd);
+    send_data(sock, m_send_queue, stdin_fd);
 
     m_ui->set_on_key([this](Key key){
-        MsgWriter msg(m_send_buffer, MessageType::Key);
+        MsgWriter msg(m_send_queue.buffer, MessageType::Key);
         msg.write(key);
-        m_socket_watcher->events() |= FdEvents::Write;
+        m_socket_watcher->set_events(m_socket_watcher->events() | FdEvents::Write);
      });
     m_ui->set_on_paste([this](StringView content){
-        MsgWriter msg(m_send_buffer, MessageType::Paste);
+        MsgWriter msg(m_send_queue.buffer, MessageType::Paste);
         msg.write(content);
-        m_socket_watcher->events() |= FdEvents::Write;
+        m_socket_watcher->set_events(m_socket_watcher->events() | FdEvents::Write);
      });
 
     m_socket_watcher.reset(new FDWatcher{sock, FdEvents::Read | FdEvents::Write, EventMode::Urgent,
-                           [this, reader = MsgReader{}](FDWatcher& watcher, FdEvents events, EventMode) mutable {
+                           [this, reader = MsgReader{}, frame_reader = MsgReader{}, display_buffer = DisplayBuffer{}]
+                           (FDWatcher& watcher, FdEvents events, EventMode) mutable {
         const int sock = watcher.fd();
-        if (events & FdEvents::Write and send_data(sock, m_send_buffer))
-            watcher.events() &= ~FdEvents::Write;
+        if (events & FdEvents::Write and send_data(sock, m_send_queue))
+            watcher.set_events(watcher.events() & ~FdEvents::Write);
 
         auto exec = [&]<typename ...Args>(void (UserInterface::*method)(Args...)) {
             struct Impl // Use a constructor to ensure left-to-right parameter evaluation
@@ -699,6 +1060,15 @@ RemoteClient::RemoteClient(StringView session, StringView name, UniquePtr<UserIn
             Impl{*m_ui, method, reader.read<std::remove_cvref_t<Args>>()...};
         };
 
+        auto draw = [&](MsgReader& reader) {
+            read_lines(reader, display_buffer);
+            auto cursor_pos = reader.read<DisplayCoord>();
+            auto default_face = reader.read<Face>();
+            auto padding_face = reader.read<Face>();
+            auto widget_columns = reader.read<ColumnCount>();
+            m_ui->draw(display_buffer, cursor_pos, default_face, padding_face, widget_columns);
+        };
+
         while (events & FdEvents::Read and
                not reader.ready() and fd_readable(sock))
         {
@@ -726,8 +1096,22 @@ RemoteClient::RemoteClient(StringView session, StringView name, UniquePtr<UserIn
                 exec(&UserInterface::info_hide);
                 break;
             case MessageType::Draw:
-                exec(&UserInterface::draw);
+            case MessageType::DrawDelta:
+                draw(reader);
                 break;
+            case MessageType::SharedDraw:
+            {
+                if (not m_shared_frames)
+                    throw disconnected{"unexpected shared frame received"};
+                auto slot = reader.read<uint32_t>();
+                auto size = reader.read<uint32_t>();
+                frame_reader.load(m_shared_frames->read(slot, size));
+                auto clear_frame_reader = OnScopeEnd([&frame_reader] { frame_reader.reset(); });
+                if (frame_reader.type() != MessageType::Draw and frame_reader.type() != MessageType::DrawDelta)
+                    throw disconnected{"invalid shared frame received"};
+                draw(frame_reader);
+                break;
+            }
             case MessageType::DrawStatus:
                 exec(&UserInterface::draw_status);
                 break;
@@ -737,6 +1121,20 @@ RemoteClient::RemoteClient(StringView session, StringView name, UniquePtr<UserIn
             case MessageType::SetOptions:
                 exec(&UserInterface::set_ui_options);
                 break;
+            case MessageType::Features:
+            {
+                auto features = reader.read<ProtocolFeatures>();
+                if (features & ProtocolFeatures::FaceTable)
+                    reader.enable_face_table();
+                if (features & ProtocolFeatures::SharedFrames)
+                {
+                    auto fd = reader.ancillary_fd();
+                    if (not fd)
+                        throw disconnected{"shared frames fd not received"};
+                    m_shared_frames.reset(new SharedFrames{*fd});
+                }
+                break;
+            }
             case MessageType::Exit:
                 m_exit_status = reader.read<int>();
                 watcher.close_fd();
@@ -748,6 +1146,8 @@ RemoteClient::RemoteClient(StringView session, StringView name, UniquePtr<UserIn
     }});
 }
 
+RemoteClient::~RemoteClient() = default;
+
 bool RemoteClient::is_ui_ok() const
 {
     return m_ui->is_ok();
@@ -804,11 +1204,12 @@ private:
                 auto init_coord = m_reader.read<Optional<BufferCoord>>();
                 auto dimensions = m_reader.read<DisplayCoord>();
                 auto env_vars = m_reader.read<HashMap<String, String, MemoryDomain::EnvVars>>();
+                auto features = read_features(m_reader);
 
                 if (auto stdin_fd = m_reader.ancillary_fd())
                     create_fifo_buffer(generate_buffer_name("*stdin-{}*"), *stdin_fd, Buffer::Flags::None,
                                        AutoScroll::NotInitially);
-                auto* ui = new RemoteUI{sock, dimensions};
+                auto* ui = new RemoteUI{sock, dimensions, features};
                 ClientManager::instance().create_client(
                     UniquePtr<UserInterface>(ui), pid, std::move(name),
                     std::move(env_vars), init_cmds, {}, init_coord,
@@ -926,4 +1327,186 @@ void Server::remove_accepter(Accepter* accepter)
     m_accepters.erase(it);
 }
 
+
+static bool same_lines(const DisplayLineList& lhs, const DisplayLineList& rhs)
+{
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                      [](const DisplayLine& l, const DisplayLine& r) { return l.atoms() == r.atoms(); });
+}
+
+UnitTest test_remote_draw_delta{[]()
+{
+    Vector<RemoteBuffer, MemoryDomain::Remote> last_lines;
+    DisplayBuffer client_frame;
+    // Sends the lines as a delta and returns how many of them were written
+    auto send = [&](const DisplayLineList& lines) {
+        RemoteBuffer buffer;
+        {
+            MsgWriter msg{buffer, MessageType::DrawDelta};
+            write_changed_lines(msg, lines, last_lines);
+        }
+        MsgReader header;
+        header.load(buffer);
+        const uint32_t line_count = header.read<uint32_t>();
+        const uint32_t changed = header.read<uint32_t>();
+        kak_assert(line_count == lines.size());
+
+        MsgReader reader;
+        reader.load(std::move(buffer));
+        read_lines(reader, client_frame);
+        kak_assert(reader.at_end());
+        kak_assert(same_lines(client_frame.lines(), lines));
+        return changed;
+    };
+    auto line = [](StringView content, Face face = {}) { return DisplayLine{content.str(), face}; };
+
+    kak_assert(send({line("a"), line("b"), line("c")}) == 3);
+    kak_assert(send({line("a"), line("b"), line("c")}) == 0);
+    kak_assert(send({line("a"), line("B"), line("c")}) == 1);
+    kak_assert(send({line("a"), line("B")}) == 0);
+    kak_assert(send({line("a"), line("B"), line("c"), line("d")}) == 2);
+    kak_assert(send({line("a", Face{Color::Red}), line("B"), line("c"), line("d")}) == 1);
+    kak_assert(send({}) == 0);
+
+    // A full frame replaces the patched one
+    DisplayBuffer full;
+    full.lines() = {line("x"), line("y")};
+    RemoteBuffer buffer;
+    MsgWriter{buffer, MessageType::Draw}.write(full);
+    MsgReader reader;
+    reader.load(std::move(buffer));
+    read_lines(reader, client_frame);
+    kak_assert(same_lines(client_frame.lines(), full.lines()));
+
+    RemoteBuffer invalid;
+    MsgWriter{invalid, MessageType::DrawDelta}.write(1u, 1u, 1u, line("z"));
+    reader.load(std::move(invalid));
+    bool disconnected_on_invalid = false;
+    try { read_lines(reader, client_frame); }
+    catch (disconnected&) { disconnected_on_invalid = true; }
+    kak_assert(disconnected_on_invalid);
+}};
+
+UnitTest test_remote_face_table{[]()
+{
+    FaceIds face_ids;
+    MsgReader reader;
+    reader.enable_face_table();
+
+    const Face red{Color::Red}, bold{Color::Blue, Color::Red, Attribute::Bold};
+    RemoteBuffer first, second;
+    MsgWriter{first, MessageType::Draw, &face_ids}.write(red, bold, red);
+    MsgWriter{second, MessageType::Draw, &face_ids}.write(bold, red);
+    // Faces are written inline once, then only as their id
+    constexpr size_t header_size = sizeof(MessageType) + sizeof(uint32_t);
+    kak_assert(first.size() == header_size + 3 * sizeof(uint16_t) + 2 * sizeof(Face));
+    kak_assert(second.size() == header_size + 2 * sizeof(uint16_t));
+
+    reader.load(std::move(first));
+    kak_assert(reader.read<Face>() == red);
+    kak_assert(reader.read<Face>() == bold);
+    kak_assert(reader.read<Face>() == red);
+    reader.load(std::move(second));
+    kak_assert(reader.read<Face>() == bold);
+    kak_assert(reader.read<Face>() == red);
+    kak_assert(reader.at_end());
+
+    // Once the table is full, new faces are always written literally
+    auto face = [](size_t i) { return Face{Color{(unsigned char)i, (unsigned char)(i >> 8), 1}}; };
+    RemoteBuffer fill;
+    {
+        MsgWriter msg{fill, MessageType::Draw, &face_ids};
+        for (size_t i = 0; i < max_face_ids + 2; ++i)
+            msg.write(face(i), face(i));
+    }
+    kak_assert(face_ids.size() == max_face_ids);
+    reader.load(std::move(fill));
+    for (size_t i = 0; i < max_face_ids + 2; ++i)
+    {
+        kak_assert(reader.read<Face>() == face(i));
+        kak_assert(reader.read<Face>() == face(i));
+    }
+    kak_assert(reader.at_end());
+
+    RemoteBuffer unknown;
+    MsgWriter{unknown, MessageType::Draw}.write((uint16_t)(max_face_ids + 1));
+    reader.load(std::move(unknown));
+    bool disconnected_on_unknown = false;
+    try { reader.read<Face>(); }
+    catch (disconnected&) { disconnected_on_unknown = true; }
+    kak_assert(disconnected_on_unknown);
+}};
+
+UnitTest test_remote_old_client{[]()
+{
+    auto connect_features = [](Optional<ProtocolFeatures> features) {
+        RemoteBuffer buffer;
+        {
+            MsgWriter msg{buffer, MessageType::Connect};
+            msg.write(42, String{"client"}, String{"echo"}, Optional<BufferCoord>{}, DisplayCoord{24, 80},
+                      HashMap<String, String, MemoryDomain::EnvVars>{{"PATH", "/bin"}});
+            if (features)
+                msg.write(*features);
+        }
+        MsgReader reader;
+        reader.load(std::move(buffer));
+        kak_assert(reader.type() == MessageType::Connect);
+        kak_assert(reader.read<int>() == 42);
+        kak_assert(reader.read<String>() == "client");
+        kak_assert(reader.read<String>() == "echo");
+        kak_assert(not reader.read<Optional<BufferCoord>>());
+        kak_assert(reader.read<DisplayCoord>() == DisplayCoord{24, 80});
+        auto env_vars = reader.read<HashMap<String, String, MemoryDomain::EnvVars>>();
+        kak_assert(env_vars.size() == 1 and env_vars[String{"PATH"}] == "/bin");
+        return read_features(reader);
+    };
+    kak_assert(connect_features({}) == ProtocolFeatures::None);
+    kak_assert(connect_features(ProtocolFeatures::Supported) == ProtocolFeatures::Supported);
+
+    // Frames for clients without the face table carry whole faces
+    DisplayBuffer display_buffer;
+    display_buffer.lines() = {DisplayLine{"a", Face{Color::Red}}, DisplayLine{"b", Face{Color::Red}}};
+    RemoteBuffer buffer;
+    MsgWriter{buffer, MessageType::Draw}.write(display_buffer);
+    MsgReader reader;
+    reader.load(std::move(buffer));
+    kak_assert(same_lines(reader.read<DisplayBuffer>().lines(), display_buffer.lines()));
+    kak_assert(reader.at_end());
+}};
+
+UnitTest test_remote_shared_frames{[]()
+{
+    SharedFrames server{SharedFrames::create_fd()};
+    SharedFrames client{dup(server.fd())};
+
+    DisplayBuffer display_buffer;
+    display_buffer.lines() = {DisplayLine{"shared", Face{Color::Green}}};
+    RemoteBuffer frame, small(16, 'a'), large(SharedFrames::slot_size + 1, 'b');
+    MsgWriter{frame, MessageType::Draw}.write(display_buffer);
+
+    kak_assert(not server.write(large));
+    kak_assert(server.write(frame) == Optional<uint32_t>{0});
+    kak_assert(server.write(small) == Optional<uint32_t>{1});
+    // Both slots wait for the client, the frame has to go through the socket
+    kak_assert(not server.write(small));
+
+    MsgReader reader;
+    reader.load(client.read(0, frame.size()));
+    kak_assert(reader.type() == MessageType::Draw);
+    kak_assert(same_lines(reader.read<DisplayBuffer>().lines(), display_buffer.lines()));
+    kak_assert(server.write(small) == Optional<uint32_t>{0});
+    kak_assert(client.read(1, small.size()) == small);
+    kak_assert(client.read(0, small.size()) == small);
+
+    auto invalid = [&](uint32_t slot, uint32_t size) {
+        try { client.read(slot, size); }
+        catch (disconnected&) { return true; }
+        return false;
+    };
+    kak_assert(invalid(0, small.size())); // already read
+    kak_assert(invalid(2, small.size()));
+    kak_assert(server.write(small) == Optional<uint32_t>{0});
+    kak_assert(invalid(0, SharedFrames::slot_size + 1));
+}};
+
 }
@@ -18,12 +18,24 @@ struct disconnected : runtime_error
 
 class FDWatcher;
 class UserInterface;
+class SharedFrames;
 
 template<typename T> struct Optional;
 struct BufferCoord;
 
 using RemoteBuffer = Vector<char, MemoryDomain::Remote>;
 
+// Data waiting to be sent, consumed by advancing pos instead of erasing
+// it, so that partial writes do not move the remaining data each time.
+struct SendQueue
+{
+    RemoteBuffer buffer;
+    size_t pos = 0;
+
+    bool empty() const { return pos == buffer.size(); }
+    size_t pending() const { return buffer.size() - pos; }
+};
+
 // A remote client handle communication between a client running on the server
 // and a user interface running on the local process.
 class RemoteClient
@@ -32,13 +44,15 @@ public:
     RemoteClient(StringView session, StringView name, UniquePtr<UserInterface>&& ui,
                  int pid, const EnvVarMap& env_vars, StringView init_command,
                  Optional<BufferCoord> init_coord, Optional<int> stdin_fd);
+    ~RemoteClient();
 
     bool is_ui_ok() const;
     const Optional<int>& exit_status() const { return m_exit_status; }
 private:
     UniquePtr<UserInterface> m_ui;
     UniquePtr<FDWatcher>     m_socket_watcher;
-    RemoteBuffer                   m_send_buffer;
+    UniquePtr<SharedFrames>  m_shared_frames;
+    SendQueue                      m_send_queue;
     Optional<int>                  m_exit_status;
 };
 
@@ -268,6 +268,8 @@ void update_selections(Vector<Selection>& selections, size_t& main, const Buffer
 
 void SelectionList::update(bool merge)
 {
+    if (m_timestamp != m_buffer->timestamp())
+        changed();
     update_selections(m_selections, m_main, *m_buffer, m_timestamp, merge);
     check_invariant();
     m_timestamp = m_buffer->timestamp();
@@ -334,11 +336,13 @@ void merge_overlapping_selections(Vector<Selection>& selections, size_t& main_in
 
 void SelectionList::sort()
 {
+    changed();
     sort_selections(m_selections, m_main);
 }
 
 void SelectionList::merge_overlapping()
 {
+    changed();
     merge_overlapping_selections(m_selections, m_main);
 }
 
@@ -415,6 +419,7 @@ void SelectionList::for_each(ApplyFunc func, bool may_append)
     // We might just have been deleting text if strings were empty,
     // in which case we could have some selections pushed out of the buffer
     fix_overflowing_selections(m_selections, *m_buffer);
+    changed(); // func might have kept using the selections it was given
 
     check_invariant();
     m_buffer->check_invariant();
@@ -114,12 +114,12 @@ struct SelectionList
     const Selection& main() const { return (*this)[m_main]; }
     Selection& main() { return (*this)[m_main]; }
     size_t main_index() const { return m_main; }
-    void set_main_index(size_t main) { kak_assert(main < size()); m_main = main; }
+    void set_main_index(size_t main) { kak_assert(main < size()); m_main = main; changed(); }
 
-    void push_back(const Selection& sel) { m_selections.push_back(sel); }
-    void push_back(Selection&& sel) { m_selections.push_back(std::move(sel)); }
+    void push_back(const Selection& sel) { changed(); m_selections.push_back(sel); }
+    void push_back(Selection&& sel) { changed(); m_selections.push_back(std::move(sel)); }
 
-    Selection& operator[](size_t i) { return m_selections[i]; }
+    Selection& operator[](size_t i) { changed(); return m_selections[i]; }
     const Selection& operator[](size_t i) const { return m_selections[i]; }
 
     void set(Vector<Selection> list, size_t main);
@@ -131,8 +131,8 @@ struct SelectionList
     }
 
     using iterator = Vector<Selection>::iterator;
-    iterator begin() { return m_selections.begin(); }
-    iterator end() { return m_selections.end(); }
+    iterator begin() { changed(); return m_selections.begin(); }
+    iterator end() { changed(); return m_selections.end(); }
 
     using const_iterator = Vector<Selection>::const_iterator;
     const_iterator begin() const { return m_selections.begin(); }
@@ -154,7 +154,11 @@ struct SelectionList
     Buffer& buffer() const { return *m_buffer; }
 
     size_t timestamp() const { return m_timestamp; }
-    void force_timestamp(size_t timestamp) { m_timestamp = timestamp; }
+    void force_timestamp(size_t timestamp) { m_timestamp = timestamp; changed(); }
+
+    // Changes on any non const access, copies keep the version of the list
+    // they were made from as long as neither is modified
+    size_t version() const { return m_version; }
 
     using ApplyFunc = FunctionRef<void (size_t index, Selection& sel)>;
     void for_each(ApplyFunc apply, bool may_append);
@@ -164,11 +168,16 @@ struct SelectionList
     void erase();
 
 private:
+    void changed() { m_version = ++s_generation; }
+
     size_t m_main = 0;
     Vector<Selection> m_selections;
 
     SafePtr<Buffer> m_buffer;
     size_t m_timestamp;
+
+    static inline size_t s_generation = 0;
+    size_t m_version = ++s_generation;
 };
 
 Vector<Selection> compute_modified_ranges(const Buffer& buffer, size_t timestamp);
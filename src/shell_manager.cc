@@ -11,12 +11,18 @@
 #include "option_manager.hh"
 #include "file.hh"
 #include "flags.hh"
+#include "buffer.hh"
 #include "option_types.hh"
+#include "profile.hh"
 #include "regex.hh"
+#include "value.hh"
 
 #include <chrono>
+#include <thread>
 #include <cstring>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -33,7 +39,8 @@ namespace Kakoune
 {
 
 ShellManager::ShellManager(ConstArrayView<EnvVarDesc> builtin_env_vars)
-    : m_env_vars{builtin_env_vars}
+    : m_env_vars{builtin_env_vars},
+      m_async_timer{TimePoint::max(), [this](Timer&) { run_async_callbacks(); }}
 {
     auto is_executable = [](StringView path) {
         struct stat st;
@@ -89,7 +96,7 @@ namespace
 Shell spawn_shell(const char* shell, StringView cmdline,
                   ConstArrayView<String> params,
                   ConstArrayView<String> kak_env,
-                  bool open_stdin) noexcept
+                  bool open_stdin, bool own_process_group = false) noexcept
 {
     Vector<const char*> envptrs;
     for (char** envp = environ; *envp; ++envp)
@@ -106,13 +113,18 @@ Shell spawn_shell(const char* shell, StringView cmdline,
         execparams.push_back(param.c_str());
     execparams.push_back(nullptr);
 
+    // pipes are close on exec, so that other shells do not inherit them
     auto make_pipe = []() -> Array<UniqueFd, 2> {
         if (int pipefd[2] = {-1, -1}; ::pipe(pipefd) == 0)
+        {
+            fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
             return {UniqueFd{pipefd[0]}, UniqueFd{pipefd[1]}};
+        }
         throw runtime_error(format("unable to create pipe, errno: {}", ::strerror(errno)));
     };
 
-    auto stdin_pipe = open_stdin ? make_pipe() : Array{UniqueFd{open("/dev/null", O_RDONLY)}, UniqueFd{}};
+    auto stdin_pipe = open_stdin ? make_pipe() : Array{UniqueFd{open("/dev/null", O_RDONLY | O_CLOEXEC)}, UniqueFd{}};
     auto stdout_pipe = make_pipe();
     auto stderr_pipe = make_pipe();
     if (pid_t pid = vfork())
@@ -120,11 +132,23 @@ Shell spawn_shell(const char* shell, StringView cmdline,
 
     constexpr auto renamefd = [](int oldfd, int newfd) {
         if (oldfd == newfd)
+        {
+            // already in place, but would be closed on exec
+            fcntl(newfd, F_SETFD, 0);
             return;
+        }
         dup2(oldfd, newfd);
         close(oldfd);
     };
 
+    // shells spawned while waiting for another one would inherit SIGCHLD blocked
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, nullptr);
+
+    if (own_process_group)
+        setpgid(0, 0);
+
     renamefd((int)stdin_pipe[0], 0);
     renamefd((int)stdout_pipe[1], 1);
     renamefd((int)stderr_pipe[1], 2);
@@ -140,60 +164,41 @@ Shell spawn_shell(const char* shell, StringView cmdline,
     return {-1, {}, {}, {}};
 }
 
-template<typename GetValue>
-Vector<String> generate_env(StringView cmdline, ConstArrayView<String> params, const Context& context, GetValue&& get_value)
+void scan_env_vars(StringView str, auto&& add_use)
 {
     static const Regex re(R"(\bkak_(quoted_)?(\w+)\b)");
-
-    Vector<String> env;
-    auto add_matches = [&](StringView s) {
-        for (auto&& match : RegexIterator{s.begin(), s.end(), re})
-        {
-            StringView name{match[2].first, match[2].second};
-            StringView shell_name{match[0].first, match[0].second};
-
-            auto match_name = [&](const String& s) {
-                return s.substr(0_byte, shell_name.length()) == shell_name and
-                       s.substr(shell_name.length(), 1_byte) == "=";
-            };
-            if (any_of(env, match_name))
-                continue;
-
-            try
-            {
-                StringView quoted{match[1].first, match[1].second};
-                Quoting quoting = match[1].matched ? Quoting::Shell : Quoting::Raw;
-                env.push_back(format("kak_{}{}={}", quoted, name, get_value(name, quoting)));
-            } catch (runtime_error&) {}
-        }
-    };
-    add_matches(cmdline);
-    for (auto&& param : params)
-        add_matches(param);
-
-    return env;
+    for (auto&& match : RegexIterator{str.begin(), str.end(), re})
+        add_use(StringView{match[2].first, match[2].second},
+                match[1].matched ? Quoting::Shell : Quoting::Raw);
 }
 
+// pipes hold 64KiB on most systems, reading or writing more per syscall would not help
+constexpr size_t pipe_chunk_size = 64 * 1024;
+
 template<typename OnClose>
-FDWatcher make_reader(int fd, String& contents, OnClose&& on_close)
+FDWatcher make_reader(int fd, String& contents, OnClose&& on_close, EventMode mode = EventMode::Urgent)
 {
-    return {fd, FdEvents::Read, EventMode::Urgent,
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    return {fd, FdEvents::Read, mode,
             [&contents, on_close](FDWatcher& watcher, FdEvents, EventMode) {
+        // shared by all readers, as its content is appended to contents right away
+        static char buffer[pipe_chunk_size];
         const int fd = watcher.fd();
-        char buffer[1024];
-        while (fd_readable(fd))
+        while (true)
         {
             ssize_t size = ::read(fd, buffer, sizeof(buffer));
+            if (size < 0 and errno == EINTR)
+                continue;
+            if (size < 0 and (errno == EAGAIN or errno == EWOULDBLOCK))
+                return;
             if (size <= 0)
             {
-                if (size < 0 and errno == EAGAIN)
-                    continue; // try again
-
                 watcher.disable();
                 on_close(size == 0);
                 return;
             }
-            contents += StringView{buffer, buffer+size};
+            contents.append(buffer, (int)size);
         }
     }};
 }
@@ -203,25 +208,49 @@ FDWatcher make_pipe_writer(UniqueFd& fd, const FunctionRef<StringView ()>& gener
     int flags = fcntl((int)fd, F_GETFL, 0);
     fcntl((int)fd, F_SETFL, flags | O_NONBLOCK);
     return {(int)fd, FdEvents::Write, EventMode::Urgent,
-            [&generator, &fd, contents=generator()](FDWatcher& watcher, FdEvents, EventMode) mutable {
-        while (fd_writable((int)fd))
+            [&generator, &fd, pending=Vector<StringView, MemoryDomain::Events>{}, finished=false]
+            (FDWatcher& watcher, FdEvents, EventMode) mutable {
+        // generated strings are gathered so that a single writev fills the pipe,
+        // the generator yields a line at a time when piping selections
+        constexpr size_t max_iovecs = 256;
+        auto close = [&] { watcher.disable(); fd.close(); };
+        while (true)
         {
-            ssize_t size = ::write((int)fd, contents.begin(),
-                                   (size_t)contents.length());
-            if (size > 0)
+            size_t pending_size = 0;
+            for (auto& str : pending)
+                pending_size += (size_t)str.length();
+            while (not finished and pending.size() < max_iovecs and pending_size < pipe_chunk_size)
             {
-                contents = contents.substr(ByteCount{(int)size});
-                if (contents.empty())
-                    contents = generator();
+                StringView str = generator();
+                if (str.empty())
+                    finished = true;
+                else
+                {
+                    pending.push_back(str);
+                    pending_size += (size_t)str.length();
+                }
             }
-            if (size == -1 and (errno == EAGAIN or errno == EWOULDBLOCK))
-                return;
-            if (size < 0 or contents.empty())
-            {
-                fd.close();
-                watcher.disable();
+            if (pending.empty())
+                return close();
+
+            iovec iov[max_iovecs];
+            for (size_t i = 0; i < pending.size(); ++i)
+                iov[i] = {const_cast<char*>(pending[i].data()), (size_t)pending[i].length()};
+
+            ssize_t size = ::writev((int)fd, iov, (int)pending.size());
+            if (size < 0 and errno == EINTR)
+                continue;
+            if (size < 0 and (errno == EAGAIN or errno == EWOULDBLOCK))
                 return;
-            }
+            if (size < 0)
+                return close();
+
+            auto it = pending.begin();
+            for (; it != pending.end() and size >= (int)it->length(); ++it)
+                size -= (int)it->length();
+            if (it != pending.end())
+                *it = it->substr(ByteCount{(int)size});
+            pending.erase(pending.begin(), it);
         }
     }};
 }
@@ -240,7 +269,7 @@ struct CommandFifos
                 mkfifo(response_fifo_path().c_str(), 0600) != 0)
                 throw runtime_error(format("unable to create command/response fifos, errno: {}", ::strerror(errno)));
 
-            int fd = open(command_fifo_path().c_str(), O_RDONLY | O_NONBLOCK);
+            int fd = open(command_fifo_path().c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
             return make_reader(fd, command, [&, fd](bool graceful) {
                 if (not graceful)
                 {
@@ -267,6 +296,477 @@ struct CommandFifos
     String response_fifo_path() const { return format("{}/response-fifo", base_dir); }
 };
 
+// Loop run by shell workers, each request runs in an asynchronous subshell
+// so that the worker can report its pid before waiting for it.
+constexpr StringView shell_worker_script = R"(
+exec 2>/dev/null
+__kak_worker_dir=$1
+while read -r __kak_worker_request; do
+    (exec 3>&1 <"$__kak_worker_dir/in" >"$__kak_worker_dir/out" 2>"$__kak_worker_dir/err"
+     echo started >&3
+     exec 3>&-
+     . "$__kak_worker_dir/request") &
+    echo "pid $!"
+    wait $!
+    echo "status $?"
+done
+)";
+
+}
+
+ConstArrayView<ShellManager::EnvVarUse> ShellManager::script_env_vars(StringView cmdline)
+{
+    // scripts are mostly evaluated over and over again from the same commands
+    // and hooks, so only scan them once
+    if (auto it = m_script_env_vars.find(cmdline); it != m_script_env_vars.end())
+        return it->value;
+
+    constexpr size_t max_scripts = 1024;
+    if (m_script_env_vars.size() >= max_scripts)
+        m_script_env_vars.clear();
+
+    Vector<EnvVarUse, MemoryDomain::EnvVars> uses;
+    scan_env_vars(cmdline, [&](StringView name, Quoting quoting) {
+        if (not any_of(uses, [&](const EnvVarUse& use) { return use.name == name and use.quoting == quoting; }))
+            uses.push_back({name.str(), quoting});
+    });
+    return m_script_env_vars.insert({cmdline.str(), std::move(uses)});
+}
+
+template<typename GetValue>
+Vector<String> ShellManager::generate_env(StringView cmdline, ConstArrayView<String> params, GetValue&& get_value)
+{
+    Vector<String> env;
+    Vector<EnvVarUse> param_uses;
+    auto add_env = [&](StringView name, Quoting quoting) {
+        try
+        {
+            env.push_back(format("kak_{}{}={}", quoting == Quoting::Shell ? "quoted_" : "",
+                                 name, get_value(name, quoting)));
+        } catch (runtime_error&) {}
+    };
+
+    auto uses = script_env_vars(cmdline);
+    for (auto& use : uses)
+        add_env(use.name, use.quoting);
+
+    auto is_use = [](StringView name, Quoting quoting) {
+        return [=](const EnvVarUse& use) { return use.name == name and use.quoting == quoting; };
+    };
+    for (auto&& param : params)
+    {
+        scan_env_vars(param, [&](StringView name, Quoting quoting) {
+            if (any_of(uses, is_use(name, quoting)) or any_of(param_uses, is_use(name, quoting)))
+                return;
+            param_uses.push_back({name.str(), quoting});
+            add_env(name, quoting);
+        });
+    }
+
+    return env;
+}
+
+// A persistent shell, running scripts without paying for a shell exec each time.
+//
+// A script is written, along with its parameters and environment, to a request
+// file sourced by the worker. Its stdin, stdout and stderr go through fifos,
+// which get recreated when processes a script left running in the background
+// still use them, so that they do not interfere with the next scripts.
+struct ShellWorker
+{
+    ShellWorker(const char* shell);
+    ~ShellWorker();
+
+    Shell start(StringView cmdline, ConstArrayView<String> params,
+                ConstArrayView<String> kak_env);
+    void read_response();
+    void finish(bool output_closed);
+
+    String path(StringView name) const { return format("{}/{}", dir, name); }
+    void create_fifo(StringView name);
+
+    String dir;
+    String cwd;
+    Shell process;
+    UniqueFd request_fd;
+    String response;
+    // keep the other end of the fifos open until the script opened its own
+    Vector<UniqueFd, MemoryDomain::Events> placeholders;
+    int script_pid = -1;
+    Optional<int> status;
+    bool busy = false;
+    bool dead = false;
+};
+
+ShellWorker::ShellWorker(const char* shell)
+    : dir{format("{}/kak-shell.XXXXXX", tmpdir())}
+{
+    if (mkdtemp(dir.data()) == nullptr)
+        throw runtime_error(format("unable to create shell worker directory, errno: {}", ::strerror(errno)));
+
+    char buffer[PATH_MAX];
+    if (getcwd(buffer, sizeof(buffer)))
+        cwd = buffer;
+
+    request_fd = UniqueFd{open(path("request").c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600)};
+    if (not request_fd)
+        throw runtime_error(format("unable to create shell worker request file, errno: {}", ::strerror(errno)));
+    for (auto name : {"in", "out", "err"})
+        create_fifo(name);
+
+    process = spawn_shell(shell, shell_worker_script, dir, {}, true);
+    process.err.close();
+    // nested event loops can leave us a stale readable event
+    fcntl((int)process.out, F_SETFL, fcntl((int)process.out, F_GETFL) | O_NONBLOCK);
+}
+
+ShellWorker::~ShellWorker()
+{
+    process.in.close();
+    process.out.close();
+    process.pid.close();
+    placeholders.clear();
+    request_fd.close();
+    for (auto name : {"request", "in", "out", "err"})
+        unlink(path(name).c_str());
+    rmdir(dir.c_str());
+}
+
+Shell ShellWorker::start(StringView cmdline, ConstArrayView<String> params,
+                         ConstArrayView<String> kak_env)
+{
+    String request = "unset __kak_worker_dir __kak_worker_request\n";
+    char buffer[PATH_MAX];
+    if (getcwd(buffer, sizeof(buffer)) and cwd != buffer)
+        request += format("cd {} 2>/dev/null\n", shell_quote(buffer));
+    request += "set --";
+    for (auto& param : params)
+        request += " " + shell_quote(param);
+    request += "\n";
+    for (auto& env : kak_env)
+    {
+        auto eq = find(env, '=');
+        request += format("export {}={}\n", StringView{env.begin(), eq}, shell_quote({eq+1, env.end()}));
+    }
+    request += cmdline;
+    request += "\n";
+    if (pwrite((int)request_fd, request.data(), (size_t)request.length(), 0) != (int)request.length() or
+        ftruncate((int)request_fd, (int)request.length()) != 0)
+        throw runtime_error(format("unable to write shell worker request, errno: {}", ::strerror(errno)));
+
+    auto open_fifo = [this](StringView name, int flags) {
+        int fd = open(path(name).c_str(), flags | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1)
+            throw runtime_error(format("unable to open shell worker fifo, errno: {}", ::strerror(errno)));
+        return UniqueFd{fd};
+    };
+
+    // without placeholders, opening the write end of stdin would fail, the
+    // script would block opening stdin if we are already done writing it,
+    // and we could see the end of stdout and stderr before it opened them.
+    Shell shell;
+    placeholders.push_back(open_fifo("in", O_RDONLY));
+    shell.in = open_fifo("in", O_WRONLY);
+    placeholders.push_back(open_fifo("in", O_WRONLY));
+    shell.out = open_fifo("out", O_RDONLY);
+    placeholders.push_back(open_fifo("out", O_WRONLY));
+    shell.err = open_fifo("err", O_RDONLY);
+    placeholders.push_back(open_fifo("err", O_WRONLY));
+
+    script_pid = -1;
+    status.reset();
+    if (::write((int)process.in, "\n", 1) != 1)
+        throw runtime_error(format("unable to send shell worker request, errno: {}", ::strerror(errno)));
+
+    return shell;
+}
+
+void ShellWorker::read_response()
+{
+    char buffer[256];
+    ssize_t size = ::read((int)process.out, buffer, sizeof(buffer));
+    if (size < 0 and errno == EAGAIN)
+        return;
+    if (size <= 0)
+    {
+        dead = true;
+        placeholders.clear();
+        if (not status)
+            status = -1;
+        return;
+    }
+
+    response += StringView{buffer, buffer + size};
+    const char* line_begin = response.begin();
+    for (auto it = response.begin(); it != response.end(); ++it)
+    {
+        if (*it != '\n')
+            continue;
+
+        StringView line{line_begin, it};
+        auto value = [&](StringView prefix) {
+            return prefix_match(line, prefix) ? str_to_int_ifp(line.substr(prefix.length())) : Optional<int>{};
+        };
+        if (line == "started")
+            placeholders.clear();
+        else if (auto pid = value("pid "))
+            script_pid = *pid;
+        else if (auto exit_status = value("status "))
+        {
+            placeholders.clear();
+            status = *exit_status;
+        }
+        line_begin = it+1;
+    }
+    response = String{line_begin, response.end()};
+}
+
+void ShellWorker::finish(bool output_closed)
+{
+    // a process still reading stdin would steal the next script input
+    if (UniqueFd fd{open(path("in").c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC)})
+        create_fifo("in");
+    if (not output_closed)
+    {
+        create_fifo("out");
+        create_fifo("err");
+    }
+}
+
+void ShellWorker::create_fifo(StringView name)
+{
+    auto fifo = path(name);
+    unlink(fifo.c_str());
+    if (mkfifo(fifo.c_str(), 0600) != 0)
+        throw runtime_error(format("unable to create shell worker fifo, errno: {}", ::strerror(errno)));
+}
+
+// Time given to cancelled asynchronous shells to exit after SIGTERM before
+// their process group gets killed with SIGKILL
+constexpr auto async_shell_kill_delay = std::chrono::seconds{1};
+
+struct AsyncShell
+{
+    AsyncShell(Shell process, StringView queue, StringView group,
+               ShellManager::AsyncCallback on_exit, Timer& callbacks_timer)
+      : queue{queue.str()}, group{group.str()}, on_exit{std::move(on_exit)},
+        process{std::move(process)},
+        stdout_reader{make_reader((int)this->process.out, stdout_contents, [this, &callbacks_timer](bool) {
+            this->process.out.close();
+            callbacks_timer.set_next_date(Clock::now());
+        }, EventMode::Normal)},
+        stderr_reader{make_reader((int)this->process.err, stderr_contents, [this, &callbacks_timer](bool) {
+            this->process.err.close();
+            callbacks_timer.set_next_date(Clock::now());
+        }, EventMode::Normal)} {}
+
+    ~AsyncShell() { kill_processes(); }
+
+    bool output_closed() const { return not process.out and not process.err; }
+
+    // the shell runs in its own process group, so that the commands it started get killed as well
+    void kill_processes(int signal = SIGTERM)
+    {
+        if (process.pid)
+            kill(-(int)process.pid, signal);
+    }
+
+    // Terminates the shell and stops reading its output, which would stay
+    // open as long as a descendant that left the group or ignores SIGTERM
+    // is alive. The shell gets killed if it did not exit by kill_date.
+    void cancel()
+    {
+        kill_processes();
+        cancelled = true;
+        kill_date = Clock::now() + async_shell_kill_delay;
+        stdout_reader.disable();
+        process.out.close();
+        stderr_reader.disable();
+        process.err.close();
+    }
+
+    // Returns true once the shell exited, without waiting for it
+    bool reap()
+    {
+        int wstatus = 0;
+        if (waitpid((int)process.pid, &wstatus, WNOHANG) != (int)process.pid)
+            return false;
+        // the process is gone, its pid must not be killed anymore
+        process.pid.descriptor = -1;
+        status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1;
+        return true;
+    }
+
+    const String queue;
+    const String group;
+    ShellManager::AsyncCallback on_exit;
+    Shell process;
+    Optional<int> status;
+    bool cancelled = false;
+    TimePoint kill_date = TimePoint::max();
+
+    String stdout_contents;
+    String stderr_contents;
+    FDWatcher stdout_reader;
+    FDWatcher stderr_reader;
+};
+
+ShellManager::~ShellManager()
+{
+    // Do not block on shells still running, give them a moment to exit,
+    // then kill them and leave whatever remains to be reaped by init
+    for (auto& async_shell : m_async_shells)
+    {
+        if (not async_shell->status)
+            async_shell->cancel();
+    }
+    auto all_reaped = [this] {
+        return all_of(m_async_shells, [](auto& async_shell) { return async_shell->status or async_shell->reap(); });
+    };
+    auto wait_until = [&](TimePoint deadline) {
+        while (not all_reaped() and Clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    };
+    wait_until(Clock::now() + std::chrono::milliseconds{100});
+    for (auto& async_shell : m_async_shells)
+        async_shell->kill_processes(SIGKILL);
+    wait_until(Clock::now() + std::chrono::milliseconds{100});
+    for (auto& async_shell : m_async_shells)
+        async_shell->process.pid.descriptor = -1;
+}
+
+ShellWorker* ShellManager::acquire_shell_worker(size_t pool_size)
+{
+    for (auto it = m_shell_pool.begin(); m_shell_pool.size() > pool_size and it != m_shell_pool.end();)
+        it = (*it)->busy ? it+1 : m_shell_pool.erase(it);
+
+    auto it = find_if(m_shell_pool, [](auto& worker) { return not worker->busy; });
+    if (it == m_shell_pool.end())
+    {
+        if (m_shell_pool.size() >= pool_size)
+            return nullptr;
+
+        try
+        {
+            m_shell_pool.push_back(make_unique_ptr<ShellWorker>(m_shell.c_str()));
+        }
+        catch (runtime_error& error)
+        {
+            write_to_debug_buffer(format("unable to start shell worker: {}", error.what()));
+            return nullptr;
+        }
+        it = m_shell_pool.end() - 1;
+    }
+
+    (*it)->busy = true;
+    return it->get();
+}
+
+void ShellManager::release_shell_worker(ShellWorker& worker)
+{
+    worker.busy = false;
+    if (worker.dead or not worker.status)
+        m_shell_pool.erase(find(m_shell_pool, &worker));
+}
+
+void ShellManager::reset_after_fork()
+{
+    // workers are children of the parent process, and exit once it closes their requests pipe
+    for (auto& worker : m_shell_pool)
+        worker->process.pid.descriptor = -1;
+    m_shell_pool.clear();
+
+    // so are asynchronous shells, which cannot be waited for anymore
+    for (auto& async_shell : m_async_shells)
+        async_shell->process.pid.descriptor = -1;
+    m_async_shells.clear();
+}
+
+void ShellManager::eval_async(StringView cmdline, const Context& context,
+                              StringView queue, StringView group, AsyncCallback on_exit,
+                              const ShellContext& shell_context)
+{
+    const DebugFlags debug_flags = context.options()["debug"].get<DebugFlags>();
+    if (debug_flags & DebugFlags::Shell)
+        write_to_debug_buffer(format("async shell:\n{}\n----\nargs: {}\n----\n", cmdline, join(shell_context.params | transform(shell_quote), ' ')));
+
+    if (not group.empty())
+    {
+        for (auto& async_shell : m_async_shells)
+        {
+            if (async_shell->group != group or async_shell->cancelled or async_shell->status)
+                continue;
+            async_shell->cancel();
+            m_async_timer.set_next_date(Clock::now());
+        }
+    }
+
+    auto kak_env = generate_env(cmdline, shell_context.params, [&](StringView name, Quoting quoting) {
+        if (auto it = shell_context.env_vars.find(name); it != shell_context.env_vars.end())
+            return it->value;
+        return env_var_value(name, quoting, context);
+    });
+
+    m_async_shells.push_back(make_unique_ptr<AsyncShell>(
+        spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env, false, true),
+        queue, group, std::move(on_exit), m_async_timer));
+}
+
+void ShellManager::run_async_callbacks()
+{
+    bool waiting_exit = false;
+    for (auto& async_shell : m_async_shells)
+    {
+        if (async_shell->status or not async_shell->output_closed() or async_shell->reap())
+            continue;
+
+        waiting_exit = true;
+        if (async_shell->cancelled and Clock::now() >= async_shell->kill_date)
+        {
+            async_shell->kill_processes(SIGKILL);
+            async_shell->kill_date = TimePoint::max();
+        }
+    }
+    // shells that closed their output, or were cancelled, are usually about to exit, poll for it
+    if (waiting_exit)
+        m_async_timer.set_next_date(Clock::now() + std::chrono::milliseconds{10});
+
+    // callbacks can start or cancel scripts, look for the next one to run from the start every time
+    while (true)
+    {
+        auto it = m_async_shells.begin();
+        for (; it != m_async_shells.end(); ++it)
+        {
+            auto& async_shell = **it;
+            if (not async_shell.status)
+                continue;
+            // earlier scripts of the same queue have to run their callback first
+            if (async_shell.cancelled or
+                not std::any_of(m_async_shells.begin(), it, [&](auto& other) {
+                    return not other->cancelled and other->queue == async_shell.queue;
+                }))
+                break;
+        }
+        if (it == m_async_shells.end())
+            return;
+
+        UniquePtr<AsyncShell> async_shell = std::move(*it);
+        m_async_shells.erase(it);
+        if (async_shell->cancelled)
+            continue;
+
+        if (not async_shell->stderr_contents.empty())
+            write_to_debug_buffer(format("shell stderr: <<<\n{}>>>", async_shell->stderr_contents));
+
+        try
+        {
+            async_shell->on_exit(std::move(async_shell->stdout_contents), *async_shell->status);
+        }
+        catch (runtime_error& error)
+        {
+            write_to_debug_buffer(format("error running async shell callback: {}", error.what()));
+        }
+    }
 }
 
 std::pair<String, int> ShellManager::eval(
@@ -275,14 +775,15 @@ std::pair<String, int> ShellManager::eval(
 {
     const DebugFlags debug_flags = context.options()["debug"].get<DebugFlags>();
     const bool profile = debug_flags & DebugFlags::Profile;
+    const bool profile_report = debug_flags & DebugFlags::ProfileReport;
     if (debug_flags & DebugFlags::Shell)
         write_to_debug_buffer(format("shell:\n{}\n----\nargs: {}\n----\n", cmdline, join(shell_context.params | transform(shell_quote), ' ')));
 
-    auto start_time = profile ? Clock::now() : Clock::time_point{};
+    auto start_time = profile or profile_report ? Clock::now() : Clock::time_point{};
 
     Optional<CommandFifos> command_fifos;
 
-    auto kak_env = generate_env(cmdline, shell_context.params, context, [&](StringView name, Quoting quoting) {
+    auto kak_env = generate_env(cmdline, shell_context.params, [&](StringView name, Quoting quoting) {
         if (name == "command_fifo" or name == "response_fifo")
         {
             if (not command_fifos)
@@ -293,17 +794,69 @@ std::pair<String, int> ShellManager::eval(
 
         if (auto it = shell_context.env_vars.find(name); it != shell_context.env_vars.end())
             return it->value;
-        return join(get_val(name, context) | transform(quoter(quoting)), ' ', false);
+        return env_var_value(name, quoting, context);
     });
 
+    String cache_key;
+    const int cache_timeout = (flags & Flags::Cacheable) ? context.options()["shell_cache_timeout"].get<int>() : 0;
+    char cwd[1024];
+    // scripts talking back through the fifos are not just computing an output
+    if (cache_timeout > 0 and not command_fifos and ::getcwd(cwd, sizeof(cwd)))
+    {
+        auto add_to_key = [&](StringView part) { cache_key += part; cache_key += StringView{"\0", 1_byte}; };
+        add_to_key(cwd);
+        add_to_key(cmdline);
+        for (auto& param : shell_context.params)
+            add_to_key(param);
+        for (auto& env : kak_env)
+            add_to_key(env);
+
+        if (auto it = m_output_cache.find(cache_key); it != m_output_cache.end())
+        {
+            if (Clock::now() < it->value.expiry)
+            {
+                if (debug_flags & DebugFlags::Shell)
+                    write_to_debug_buffer("shell output reused from cache");
+                return {it->value.output, it->value.status};
+            }
+            m_output_cache.remove(cache_key);
+        }
+    }
+
     auto spawn_time = profile ? Clock::now() : Clock::time_point{};
-    auto shell = spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env, true);
+    ShellWorker* worker = acquire_shell_worker(context.options()["shell_pool_size"].get<int>());
+    OnScopeEnd release_worker{[&] { if (worker) release_shell_worker(*worker); }};
+
+    Shell shell;
+    if (worker)
+    {
+        try
+        {
+            shell = worker->start(cmdline, shell_context.params, kak_env);
+        }
+        catch (runtime_error& error)
+        {
+            write_to_debug_buffer(format("unable to use shell worker: {}", error.what()));
+            release_shell_worker(*worker);
+            worker = nullptr;
+        }
+    }
+    if (not worker)
+        shell = spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env, true);
     auto wait_time = Clock::now();
 
     String stdout_contents, stderr_contents;
     auto stdout_reader = make_reader((int)shell.out, stdout_contents, [&](bool){ shell.out.close(); });
     auto stderr_reader = make_reader((int)shell.err, stderr_contents, [&](bool){ shell.err.close(); });
     auto stdin_writer = make_pipe_writer(shell.in, input_generator);
+    Optional<FDWatcher> worker_reader;
+    if (worker)
+        worker_reader.emplace((int)worker->process.out, FdEvents::Read, EventMode::Urgent,
+                              [worker](FDWatcher& watcher, FdEvents, EventMode) {
+            worker->read_response();
+            if (worker->dead)
+                watcher.disable();
+        });
 
     // block SIGCHLD to make sure we wont receive it before
     // our call to pselect, that will end up blocking indefinitly.
@@ -315,7 +868,7 @@ std::pair<String, int> ShellManager::eval(
 
     int status = 0;
     // check for termination now that SIGCHLD is blocked
-    bool terminated = waitpid((int)shell.pid, &status, WNOHANG) != 0;
+    bool terminated = not worker and waitpid((int)shell.pid, &status, WNOHANG) != 0;
     bool failed = false;
 
     using namespace std::chrono;
@@ -335,7 +888,11 @@ std::pair<String, int> ShellManager::eval(
         }
         catch (cancel&)
         {
-            kill((int)shell.pid, SIGINT);
+            // scripts run by workers are asynchronous lists, which ignore SIGINT
+            if (not worker)
+                kill((int)shell.pid, SIGINT);
+            else if (worker->script_pid > 0)
+                kill(worker->script_pid, SIGTERM);
             cancelling = true;
         }
         catch (runtime_error& error)
@@ -344,12 +901,28 @@ std::pair<String, int> ShellManager::eval(
             failed = true;
         }
         if (not terminated)
-            terminated = waitpid((int)shell.pid, &status, WNOHANG) == (int)shell.pid;
+            terminated = worker ? (bool)worker->status
+                                : waitpid((int)shell.pid, &status, WNOHANG) == (int)shell.pid;
+    }
+
+    if (worker and not worker->dead)
+    {
+        try
+        {
+            worker->finish(not shell.out and not shell.err);
+        }
+        catch (runtime_error& error)
+        {
+            write_to_debug_buffer(format("error while resetting shell worker: {}", error.what()));
+            worker->dead = true;
+        }
     }
 
     if (not stderr_contents.empty())
         write_to_debug_buffer(format("shell stderr: <<<\n{}>>>", stderr_contents));
 
+    if (profile_report)
+        add_profiled_shell_time(duration_cast<microseconds>(Clock::now() - start_time));
     if (profile)
     {
         auto end_time = Clock::now();
@@ -363,16 +936,33 @@ std::pair<String, int> ShellManager::eval(
     if (cancelling)
         throw cancel{};
 
-    return { std::move(stdout_contents), WIFEXITED(status) ? WEXITSTATUS(status) : -1 };
+    const int exit_status = worker ? *worker->status : (WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+    if (not cache_key.empty())
+    {
+        constexpr size_t max_cached_outputs = 256;
+        const auto now = Clock::now();
+        for (auto it = m_output_cache.begin(); m_output_cache.size() >= max_cached_outputs and it != m_output_cache.end();)
+        {
+            if (it->value.expiry <= now)
+                m_output_cache.remove(it);
+            else
+                ++it;
+        }
+        // the cache keeps insertion order, drop the oldest outputs
+        while (m_output_cache.size() >= max_cached_outputs)
+            m_output_cache.remove(m_output_cache.begin());
+        m_output_cache.insert({std::move(cache_key), {stdout_contents, exit_status, now + std::chrono::milliseconds{cache_timeout}}});
+    }
+    return { std::move(stdout_contents), exit_status };
 }
 
 Shell ShellManager::spawn(StringView cmdline, const Context& context,
                           bool open_stdin, const ShellContext& shell_context)
 {
-    auto kak_env = generate_env(cmdline, shell_context.params, context, [&](StringView name, Quoting quoting) {
+    auto kak_env = generate_env(cmdline, shell_context.params, [&](StringView name, Quoting quoting) {
         if (auto it = shell_context.env_vars.find(name); it != shell_context.env_vars.end())
             return it->value;
-        return join(get_val(name, context) | transform(quoter(quoting)), ' ', false);
+        return env_var_value(name, quoting, context);
     });
 
     return spawn_shell(m_shell.c_str(), cmdline, shell_context.params, kak_env, open_stdin);
@@ -390,6 +980,50 @@ Vector<String> ShellManager::get_val(StringView name, const Context& context) co
     return env_var->func(name, context);
 }
 
+void ShellManager::release_env_var_cache()
+{
+    if (--m_env_var_cache_users == 0)
+        m_env_var_cache = {};
+}
+
+String ShellManager::env_var_value(StringView name, Quoting quoting, const Context& context)
+{
+    auto env_var = find_if(m_env_vars, [name](const EnvVarDesc& desc) {
+        return desc.prefix ? prefix_match(name, desc.str) : name == desc.str;
+    });
+
+    if (env_var == m_env_vars.end())
+        throw runtime_error("no such variable: " + name);
+
+    auto compute_value = [&] {
+        return join(env_var->func(name, context) | transform(quoter(quoting)), ' ', false);
+    };
+    if (not env_var->cacheable or not context.has_buffer() or m_env_var_cache_users == 0)
+        return compute_value();
+
+    const Buffer& buffer = context.buffer();
+    const size_t selections_version = context.selections().version();
+    auto& cache = m_env_var_cache;
+    if (cache.buffer != &buffer or
+        cache.timestamp != buffer.timestamp() or
+        cache.option_generation != Option::generation() or
+        cache.options != &context.options() or
+        cache.selections_version != selections_version)
+    {
+        cache.buffer = &buffer;
+        cache.timestamp = buffer.timestamp();
+        cache.option_generation = Option::generation();
+        cache.options = &context.options();
+        cache.selections_version = selections_version;
+        cache.values.clear();
+    }
+
+    const String key = format("{}{}", quoting == Quoting::Shell ? "quoted_" : "", name);
+    if (auto it = cache.values.find(key); it != cache.values.end())
+        return it->value;
+    return cache.values.insert({key, compute_value()});
+}
+
 CandidateList ShellManager::complete_env_var(StringView prefix,
                                              ByteCount cursor_pos) const
 {
@@ -3,9 +3,13 @@
 
 #include "array_view.hh"
 #include "env_vars.hh"
+#include "event_manager.hh"
+#include "function.hh"
+#include "hash_map.hh"
 #include "string.hh"
 #include "utils.hh"
 #include "unique_descriptor.hh"
+#include "unique_ptr.hh"
 #include "completion.hh"
 
 #include <signal.h>
@@ -15,7 +19,12 @@
 namespace Kakoune
 {
 
+class Buffer;
 class Context;
+class OptionManager;
+struct ShellWorker;
+struct AsyncShell;
+enum class Quoting;
 
 struct ShellContext
 {
@@ -30,6 +39,9 @@ struct EnvVarDesc
     StringView str;
     bool prefix;
     Retriever func;
+    // value only depends on the buffer content, selections and options, so
+    // it can be reused until one of them changes
+    bool cacheable = false;
 };
 
 inline void closepid(int pid){ kill(pid, SIGTERM); int status = 0; waitpid(pid, &status, 0); }
@@ -49,11 +61,15 @@ class ShellManager : public Singleton<ShellManager>
 {
 public:
     ShellManager(ConstArrayView<EnvVarDesc> builtin_env_vars);
+    ~ShellManager();
 
     enum class Flags
     {
         None = 0,
-        WaitForStdout = 1
+        WaitForStdout = 1,
+        // the output can be reused for the same script and kak_* values,
+        // see the shell_cache_timeout option
+        Cacheable = 2
     };
     friend constexpr bool with_bit_ops(Meta::Type<Flags>) { return true; }
 
@@ -72,6 +88,17 @@ public:
                     flags, shell_context);
     }
 
+    using AsyncCallback = Function<void (String output, int status)>;
+
+    // Starts cmdline without waiting for it. on_exit gets called from the
+    // event loop once the shell exited and closed its output, after the
+    // callbacks of the scripts previously started in the same queue.
+    // Starting a script in a non empty group cancels the unfinished scripts
+    // of that group: they get killed and their callback is not called.
+    void eval_async(StringView cmdline, const Context& context,
+                    StringView queue, StringView group, AsyncCallback on_exit,
+                    const ShellContext& shell_context = {});
+
     Shell spawn(StringView cmdline,
                 const Context& context,
                 bool open_stdin,
@@ -81,10 +108,73 @@ public:
 
     CandidateList complete_env_var(StringView prefix, ByteCount cursor_pos) const;
 
+    // to be called in a forked process, the shell workers belong to the parent
+    void reset_after_fork();
+
+    // Keeps the values of cacheable kak_* variables computed until the
+    // returned object is destroyed, so that the shell evaluations of a
+    // command line can share them
+    [[nodiscard]] auto env_var_cache_scope()
+    {
+        ++m_env_var_cache_users;
+        return OnScopeEnd([this] { release_env_var_cache(); });
+    }
+
 private:
+    struct EnvVarUse
+    {
+        String name;
+        Quoting quoting;
+    };
+
+    ConstArrayView<EnvVarUse> script_env_vars(StringView cmdline);
+    template<typename GetValue>
+    Vector<String> generate_env(StringView cmdline, ConstArrayView<String> params, GetValue&& get_value);
+    String env_var_value(StringView name, Quoting quoting, const Context& context);
+    void release_env_var_cache();
+
+    ShellWorker* acquire_shell_worker(size_t pool_size);
+    void release_shell_worker(ShellWorker& worker);
+
+    void run_async_callbacks();
+
     String m_shell;
 
     ConstArrayView<EnvVarDesc> m_env_vars;
+
+    // kak_* variables referenced by recently evaluated scripts
+    HashMap<String, Vector<EnvVarUse, MemoryDomain::EnvVars>, MemoryDomain::EnvVars> m_script_env_vars;
+
+    // persistent shells running eval() scripts, see the shell_pool_size option
+    Vector<UniquePtr<ShellWorker>, MemoryDomain::Events> m_shell_pool;
+
+    struct CachedOutput
+    {
+        String output;
+        int status;
+        TimePoint expiry;
+    };
+
+    // values of cacheable variables, valid as long as the buffer, the
+    // selections and the options they were computed from did not change
+    struct EnvVarCache
+    {
+        const Buffer* buffer = nullptr;
+        size_t timestamp = 0;
+        size_t option_generation = 0;
+        const OptionManager* options = nullptr;
+        size_t selections_version = 0;
+        HashMap<String, String, MemoryDomain::EnvVars> values;
+    };
+    EnvVarCache m_env_var_cache;
+    int m_env_var_cache_users = 0;
+
+    // outputs of Cacheable scripts, keyed by working directory, script, parameters and environment
+    HashMap<String, CachedOutput, MemoryDomain::EnvVars> m_output_cache;
+
+    // eval_async() scripts in start order, and the timer running their callbacks
+    Vector<UniquePtr<AsyncShell>, MemoryDomain::Events> m_async_shells;
+    Timer m_async_timer;
 };
 
 }
@@ -9,6 +9,7 @@
 #include "format.hh"
 #include "diff.hh"
 #include "string_utils.hh"
+#include "unit_tests.hh"
 
 #include <algorithm>
 
@@ -219,12 +220,17 @@ static void format_with(Writer& writer, StringView format, Args&&... args)
     format_with([&](StringView s) { writer.write(s); }, format, std::forward<Args>(args)...);
 }
 
-void TerminalUI::Screen::set_face(const Face& face, Writer& writer)
+void TerminalUI::Screen::set_face(Face face, Writer& writer)
 {
     static constexpr int fg_table[]{ 39, 30, 31, 32, 33, 34, 35, 36, 37, 90, 91, 92, 93, 94, 95, 96, 97 };
     static constexpr int bg_table[]{ 49, 40, 41, 42, 43, 44, 45, 46, 47, 100, 101, 102, 103, 104, 105, 106, 107 };
     static constexpr int ul_table[]{ 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
     static constexpr const char* attr_table[]{ "0", "4", "4:3", "21", "7", "5", "1", "2", "3", "9" };
+    static constexpr struct { Attribute attributes; const char* code; } attr_off_table[]{
+        { Attribute::Underline | Attribute::CurlyUnderline | Attribute::DoubleUnderline, "24" },
+        { Attribute::Reverse, "27" }, { Attribute::Blink, "25" }, { Attribute::Bold | Attribute::Dim, "22" },
+        { Attribute::Italic, "23" }, { Attribute::Strikethrough, "29" }
+    };
 
     auto set_color = [&](bool fg, const Color& color, bool join) {
         if (join)
@@ -235,6 +241,7 @@ void TerminalUI::Screen::set_face(const Face& face, Writer& writer)
             format_with(writer, "{}", (fg ? fg_table : bg_table)[(int)(char)color.color]);
     };
 
+    face.attributes &= ~Attribute::Final; // only matters when merging faces
     if (m_active_face == face)
         return;
 
@@ -242,13 +249,57 @@ void TerminalUI::Screen::set_face(const Face& face, Writer& writer)
     bool join = false;
     if (face.attributes != m_active_face.attributes)
     {
+        // Either turn off the removed attributes, which might turn off kept
+        // ones sharing the same off code, or reset everything, whichever
+        // needs the fewer parameters
+        Attribute enabled = face.attributes & ~m_active_face.attributes;
+        const Attribute disabled = m_active_face.attributes & ~face.attributes;
+        int off_count = 0;
+        for (auto& [attributes, code] : attr_off_table)
+        {
+            if (disabled & attributes)
+            {
+                ++off_count;
+                enabled |= Attribute{face.attributes & attributes};
+            }
+        }
+
+        auto count_attributes = [](Attribute attributes) {
+            int count = 0;
+            for (int i = 0; i < std::size(attr_table); ++i)
+                count += (attributes & (Attribute)(1 << i)) ? 1 : 0;
+            return count;
+        };
+        auto count_color_changes = [&](const Face& from) {
+            return (from.fg != face.fg) + (from.bg != face.bg) + (from.underline != face.underline);
+        };
+        if (count_attributes(face.attributes) + count_color_changes(Face{}) <
+            off_count + count_attributes(enabled) + count_color_changes(m_active_face))
+        {
+            // the leading empty parameter resets everything
+            m_active_face.fg = m_active_face.bg = m_active_face.underline = Color::Default;
+            enabled = face.attributes;
+            join = true;
+        }
+        else
+        {
+            for (auto& [attributes, code] : attr_off_table)
+            {
+                if (disabled & attributes)
+                {
+                    format_with(writer, join ? ";{}" : "{}", code);
+                    join = true;
+                }
+            }
+        }
         for (int i = 0; i < std::size(attr_table); ++i)
         {
-            if (face.attributes & (Attribute)(1 << i))
-                format_with(writer, ";{}", attr_table[i]);
+            if (enabled & (Attribute)(1 << i))
+            {
+                format_with(writer, join ? ";{}" : "{}", attr_table[i]);
+                join = true;
+            }
         }
-        m_active_face.fg = m_active_face.bg = m_active_face.underline = Color::Default;
-        join = true;
     }
     if (m_active_face.fg != face.fg)
     {
@@ -279,14 +330,70 @@ void TerminalUI::Screen::set_face(const Face& face, Writer& writer)
     m_active_face = face;
 }
 
+void TerminalUI::Screen::create(const DisplayCoord& pos, const DisplayCoord& size)
+{
+    Window::create(pos, size);
+    hashes.reset(new size_t[(int)size.line]{});
+    cells.reset(new Cells[(int)size.line]);
+}
+
+// Split the line in terminal cells, and gather its text so that the cells
+// text can be found from their start offset
+void TerminalUI::Screen::to_cells(const Line& line, Cells& cells,
+                                  String& text, Vector<ByteCount>& offsets)
+{
+    constexpr size_t combined = size_t{1} << (sizeof(size_t) * 8 - 1);
+
+    cells.clear();
+    text.clear();
+    offsets.clear();
+    for (auto& [atom_text, skip, face] : line.atoms)
+    {
+        for (auto it = atom_text.begin(), end = atom_text.end(); it != end;)
+        {
+            auto begin = it;
+            const Codepoint cp = utf8::read_codepoint(it, end);
+            const auto width = codepoint_width(cp);
+            text += StringView{begin, it};
+            if (width == 0)
+            {
+                if (not cells.empty())
+                {
+                    auto& cell = cells.back().content == 0 ? cells.end()[-2] : cells.back();
+                    cell.content = combine_hash(cell.content, cp) | combined;
+                }
+                continue;
+            }
+
+            offsets.push_back(text.length() - (it - begin));
+            cells.push_back({cp, face});
+            if (width == 2)
+            {
+                offsets.push_back(text.length());
+                cells.push_back({0, face});
+            }
+        }
+        for (auto i = 0_col; i < skip; ++i)
+        {
+            offsets.push_back(text.length());
+            text += ' ';
+            cells.push_back({' ', face});
+        }
+    }
+    offsets.push_back(text.length());
+}
+
 void TerminalUI::Screen::output(bool force, bool synchronized, Writer& writer)
 {
     if (not lines)
         return;
 
+    const int line_count = (int)size.line;
     if (force)
     {
-        std::fill_n(hashes.get(), (size_t)size.line, 0);
+        std::fill_n(hashes.get(), line_count, 0);
+        for (auto& line_cells : ArrayView{cells.get(), (size_t)line_count})
+            line_cells.clear();
         writer.write("\033[m");
         m_active_face = Face{};
     }
@@ -295,28 +402,122 @@ void TerminalUI::Screen::output(bool force, bool synchronized, Writer& writer)
         return (hash_value(line.atoms) << 1) | 1; // ensure non-zero
     };
 
-    auto output_line = [&](const Line& line) {
-        ColumnCount pending_move = 0;
-        for (auto& [text, skip, face] : line.atoms)
+    // terminal cursor position, if known
+    Optional<DisplayCoord> cursor;
+    auto move_to = [&](int line, int column) {
+        if (cursor and cursor->line == line and cursor->column <= column)
         {
-            if (text.empty() and skip == 0)
-                continue;
+            if (int distance = column - (int)cursor->column; distance > 0)
+                format_with(writer, "\033[{}C", distance);
+        }
+        else if (column == 0)
+            format_with(writer, "\033[{}H", line + 1);
+        else
+            format_with(writer, "\033[{};{}H", line + 1, column + 1);
+        cursor = DisplayCoord{line, column};
+    };
+
+    // Only write the cells of a line that differ from the terminal ones,
+    // grouping the close ones to avoid moving the cursor too often.
+    Cells new_cells;
+    String text;
+    Vector<ByteCount> offsets;
+    auto output_line = [&](int line) {
+        to_cells(lines[line], new_cells, text, offsets);
+        auto& old_cells = cells[line];
+        const int width = (int)new_cells.size();
+        const bool known = (int)old_cells.size() == width;
+        if (width == 0)
+            return;
 
-            if (pending_move != 0)
+        // blanks ending the line, which are left as is by erasing with their face
+        auto& tail_face = new_cells.back().face;
+        int blank_tail = width;
+        while (blank_tail > 0 and new_cells[blank_tail-1].content == ' ' and new_cells[blank_tail-1].face == tail_face)
+            --blank_tail;
+
+        auto write_span = [&](int begin, int end) {
+            for (int column = begin; column < end;)
             {
-                format_with(writer, "\033[{}C", (int)pending_move);
-                pending_move = 0;
+                auto& face = new_cells[column].face;
+                int face_end = column + 1;
+                while (face_end < end and new_cells[face_end].face == face)
+                    ++face_end;
+
+                // Blank runs can be erased when the rest of the line is written
+                // or is blanks of the same face
+                auto is_blank = [&](int i) { return new_cells[i].content == ' '; };
+                int blank_begin = face_end;
+                if (face.attributes == Attribute::Normal and
+                    (end == width or (end >= blank_tail and face == tail_face)))
+                {
+                    for (int i = column; i < face_end and blank_begin == face_end; ++i)
+                    {
+                        int j = i;
+                        while (j < face_end and is_blank(j))
+                            ++j;
+                        if (j - i > 3)
+                            blank_begin = i;
+                        i = j;
+                    }
+                }
+
+                set_face(face, writer);
+                if (blank_begin != column)
+                {
+                    move_to(line, column);
+                    writer.write(text.substr(offsets[column], offsets[blank_begin] - offsets[column]));
+                    cursor->column = blank_begin;
+                }
+                if (blank_begin != face_end)
+                {
+                    move_to(line, blank_begin);
+                    writer.write("\033[K");
+                    column = blank_begin;
+                    while (column < face_end and is_blank(column))
+                        ++column;
+                }
+                else
+                    column = face_end;
             }
-            set_face(face, writer);
-            writer.write(text);
-            if (skip > 3 and face.attributes == Attribute{})
+            // the cursor position is unclear once the last column is written
+            if (end == width)
+                cursor.reset();
+        };
+
+        auto is_continuation = [&](int i) {
+            return i < width and (new_cells[i].content == 0 or (known and old_cells[i].content == 0));
+        };
+        for (int column = 0; column < width;)
+        {
+            if (known)
             {
-                writer.write("\033[K");
-                pending_move = skip;
+                while (column < width and old_cells[column] == new_cells[column])
+                    ++column;
+                if (column == width)
+                    break;
             }
-            else if (skip > 0)
-                writer.write(String{' ', skip});
+
+            int begin = column, end = width;
+            if (known)
+            {
+                end = column + 1;
+                for (int i = end, gap = 0; i < width and gap < 4; ++i)
+                {
+                    if (old_cells[i] != new_cells[i])
+                        end = i + 1, gap = 0;
+                    else
+                        ++gap;
+                }
+                while (begin > 0 and is_continuation(begin))
+                    --begin;
+                while (is_continuation(end))
+                    ++end;
+            }
+            write_span(begin, end);
+            column = end;
         }
+        std::swap(old_cells, new_cells);
     };
 
     if (synchronized)
@@ -325,9 +526,9 @@ void TerminalUI::Screen::output(bool force, bool synchronized, Writer& writer)
 
         struct Change { int keep; int add; int del; };
         Vector<Change> changes{Change{}};
-        auto new_hashes = ArrayView{lines.get(), (size_t)size.line} | transform(hash_line);
-        for_each_diff(hashes.get(), (int)size.line,
-                      new_hashes.begin(), (int)size.line,
+        auto new_hashes = ArrayView{lines.get(), (size_t)line_count} | transform(hash_line);
+        for_each_diff(hashes.get(), line_count,
+                      new_hashes.begin(), line_count,
                       [&changes](DiffOp op, int len) mutable {
             switch (op)
             {
@@ -344,6 +545,7 @@ void TerminalUI::Screen::output(bool force, bool synchronized, Writer& writer)
         });
         std::copy(new_hashes.begin(), new_hashes.end(), hashes.get());
 
+        auto* rows = cells.get();
         int line = 0;
         for (auto& change : changes)
         {
@@ -351,6 +553,9 @@ void TerminalUI::Screen::output(bool force, bool synchronized, Writer& writer)
             if (int del = change.del - change.add; del > 0)
             {
                 format_with(writer, "\033[{}H\033[{}M", line + 1, del);
+                cursor = DisplayCoord{line, 0};
+                std::move(rows + line + del, rows + line_count, rows + line);
+                std::for_each(rows + line_count - del, rows + line_count, [](Cells& c) { c.clear(); });
                 line -= del;
             }
             line += change.del;
@@ -363,11 +568,14 @@ void TerminalUI::Screen::output(bool force, bool synchronized, Writer& writer)
             for (int i = 0; i < change.add; ++i)
             {
                 if (int add = change.add - change.del; i == 0 and add > 0)
+                {
                     format_with(writer, "\033[{}H\033[{}L", line + 1, add);
-                else
-                    format_with(writer, "\033[{}H", line + 1);
+                    cursor = DisplayCoord{line, 0};
+                    std::move_backward(rows + line, rows + line_count - add, rows + line_count);
+                    std::for_each(rows + line, rows + line + add, [](Cells& c) { c.clear(); });
+                }
 
-                output_line(lines[line++]);
+                output_line(line++);
             }
         }
 
@@ -375,15 +583,75 @@ void TerminalUI::Screen::output(bool force, bool synchronized, Writer& writer)
     }
     else
     {
-        for (int line = 0; line < (int)size.line; ++line)
+        Vector<size_t> new_hashes;
+        new_hashes.reserve(line_count);
+        for (int line = 0; line < line_count; ++line)
+            new_hashes.push_back(hash_line(lines[line]));
+
+        // Look for a range of lines that moved up or down, as when the view
+        // scrolls, and move it with a scroll region instead of writing it
+        // again. Scrolling blanks the lines it exposes, so a shift is only
+        // used if it leaves fewer lines to write.
+        Vector<int> changed_before{0}; // number of changed lines before each line
+        for (int line = 0; line < line_count; ++line)
+            changed_before.push_back(changed_before.back() + (hashes[line] != new_hashes[line]));
+
+        struct Shift { int begin; int end; int amount; int count; };
+        Shift best_shift{}; // only meaningful once best_gain is positive
+        int best_gain = 0;
+        auto try_shift = [&](const size_t* from, const size_t* to, int amount, bool up) {
+            for (int begin = 0; begin + amount < line_count; ++begin)
+            {
+                int count = 0;
+                while (begin + amount + count < line_count and from[begin + amount + count] == to[begin + count])
+                    ++count;
+                if (count == 0)
+                    continue;
+                const int end = begin + amount + count;
+                if (int gain = changed_before[end] - changed_before[begin] - amount; gain > best_gain)
+                {
+                    best_gain = gain;
+                    best_shift = Shift{begin, end, up ? amount : -amount, count};
+                }
+                begin += count - 1;
+            }
+        };
+        if (changed_before.back() > 1)
+        {
+            for (int amount = 1; amount < line_count; ++amount)
+            {
+                try_shift(hashes.get(), new_hashes.data(), amount, true);
+                try_shift(new_hashes.data(), hashes.get(), amount, false);
+            }
+        }
+
+        if (best_gain > 0)
         {
-            auto hash = hash_line(lines[line]);
+            auto [begin, end, amount, count] = best_shift;
+            format_with(writer, "\033[{};{}r\033[{}{}\033[r", begin + 1, end, std::abs(amount), amount > 0 ? "S" : "T");
+            auto scroll = [&](auto* region, auto blank) {
+                if (amount > 0)
+                {
+                    std::move(region + amount, region + amount + count, region);
+                    std::fill_n(region + count, amount, blank);
+                }
+                else
+                {
+                    std::move_backward(region, region + count, region + count - amount);
+                    std::fill_n(region, -amount, blank);
+                }
+            };
+            scroll(hashes.get() + begin, size_t{0});
+            scroll(cells.get() + begin, Cells{});
+        }
+
+        for (int line = 0; line < line_count; ++line)
+        {
+            auto hash = new_hashes[line];
             if (hash == hashes[line])
                 continue;
             hashes[line] = hash;
-
-            format_with(writer, "\033[{}H", line + 1);
-            output_line(lines[line]);
+            output_line(line);
         }
     }
 }
@@ -672,7 +940,6 @@ void TerminalUI::check_resize(bool force)
 
     m_window.create({0, 0}, terminal_size);
     m_screen.create({0, 0}, terminal_size);
-    m_screen.hashes.reset(new size_t[(int)terminal_size.line]{});
     kak_assert(m_window);
 
     m_dimensions = terminal_size - 1_line;
@@ -1606,4 +1873,71 @@ void TerminalUI::set_ui_options(const Options& options)
     m_info_max_width = find("terminal_info_max_width").map(str_to_int_ifp).value_or(0);
 }
 
+struct TerminalOutputTest
+{
+    using Screen = TerminalUI::Screen;
+};
+
+UnitTest test_terminal_output{[]()
+{
+    // Count the bytes written to the terminal when editing
+    TerminalOutputTest::Screen screen;
+    screen.create({0, 0}, {6_line, 200_col});
+
+    auto draw = [&](LineCount line, ConstArrayView<DisplayAtom> atoms) {
+        screen.draw({line, 0}, atoms, Face{});
+    };
+    auto output = [&](bool synchronized = false) {
+        int fds[2];
+        [[maybe_unused]] const bool piped = pipe(fds) == 0;
+        kak_assert(piped);
+        {
+            Writer writer{fds[1]};
+            screen.output(false, synchronized, writer);
+        }
+        close(fds[1]);
+        String res;
+        char buffer[1024];
+        for (ssize_t len; (len = read(fds[0], buffer, sizeof(buffer))) > 0;)
+            res += StringView{buffer, buffer + len};
+        close(fds[0]);
+        return res;
+    };
+
+    for (auto line = 0_line; line < 6; ++line)
+        draw(line, DisplayAtom{format("line {}", line)});
+    kak_assert(output() == "\033[1Hline 0\033[K\033[2Hline 1\033[K\033[3Hline 2\033[K"
+                           "\033[4Hline 3\033[K\033[5Hline 4\033[K\033[6Hline 5\033[K");
+
+    // typing at the end of a long line
+    const String long_line{'a', CharCount{150}};
+    draw(2_line, DisplayAtom{long_line});
+    output();
+    draw(2_line, DisplayAtom{long_line + "x"});
+    kak_assert(output() == "\033[3;151Hx");
+    draw(2_line, DisplayAtom{long_line + "xy"});
+    kak_assert(output() == "\033[3;152Hy");
+
+    // changing faces
+    const Face bold{Color::Default, Color::Default, Attribute::Bold};
+    const Face red_bold{Color::Red, Color::Default, Attribute::Bold};
+    draw(0_line, ConstArrayView<DisplayAtom>{DisplayAtom{"line", bold}, DisplayAtom{" 0"}});
+    kak_assert(output() == "\033[1m\033[1Hline");
+    draw(0_line, ConstArrayView<DisplayAtom>{DisplayAtom{"line", red_bold}, DisplayAtom{" 0", bold}});
+    kak_assert(output() == "\033[31m\033[1Hline\033[39m 0");
+    draw(0_line, DisplayAtom{"line 0"});
+    kak_assert(output() == "\033[m\033[1Hline 0");
+
+    // scrolling
+    draw(2_line, DisplayAtom{"line 2"});
+    kak_assert(output() == "\033[3Hline 2\033[K");
+    for (auto line = 0_line; line < 5; ++line)
+        draw(line, DisplayAtom{format("line {}", line + 1)});
+    draw(5_line, DisplayAtom{"line 6"});
+    kak_assert(output() == "\033[1;6r\033[1S\033[r\033[6Hline 6\033[K");
+
+    draw(5_line, DisplayAtom{"line 7"});
+    kak_assert(output(true) == "\033[?2026h\033[6;6H7\033[?2026l");
+}};
+
 }
@@ -93,13 +93,32 @@ private:
 
     struct Screen : Window
     {
+        void create(const DisplayCoord& pos, const DisplayCoord& size);
         void output(bool force, bool synchronized, Writer& writer);
-        void set_face(const Face& face, Writer& writer);
+        void set_face(Face face, Writer& writer);
+
+        struct Cell
+        {
+            // codepoint, hash of the codepoints for cells with combining ones,
+            // or 0 for the second column of a double width codepoint
+            size_t content;
+            Face face;
+
+            friend bool operator==(const Cell&, const Cell&) = default;
+        };
+        using Cells = Vector<Cell, MemoryDomain::Display>;
+
+        static void to_cells(const Line& line, Cells& cells,
+                             String& text, Vector<ByteCount>& offsets);
 
         UniquePtr<size_t[]> hashes;
+        // content of the terminal, empty when unknown
+        UniquePtr<Cells[]> cells;
         Face m_active_face;
     };
 
+    friend struct TerminalOutputTest;
+
     Window m_window;
     Screen m_screen;
 
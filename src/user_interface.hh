@@ -45,6 +45,7 @@ enum class EventMode;
 
 using OnKeyCallback = Function<void(Key key)>;
 using OnPasteCallback = Function<void(StringView content)>;
+using OnRedrawCallback = Function<void()>;
 
 class UserInterface
 {
@@ -84,6 +85,9 @@ public:
 
     virtual void set_on_key(OnKeyCallback callback) = 0;
     virtual void set_on_paste(OnPasteCallback callback) = 0;
+    // called when the ui lost some of what it was sent, and needs
+    // everything to be drawn again
+    virtual void set_on_redraw(OnRedrawCallback callback) {}
 
     using Options = HashMap<String, String, MemoryDomain::Options>;
     virtual void set_ui_options(const Options& options) = 0;
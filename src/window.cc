@@ -113,6 +113,37 @@ bool Window::needs_redraw(const Context& context) const
                        m_last_setup.selections.begin(), m_last_setup.selections.end());
 }
 
+static BufferRange full_line_range(const Buffer& buffer, LineCount line)
+{
+    return {line, {line, buffer[line].length()}};
+}
+
+// Lines longer than margin are cut to the given columns plus margin
+// bytes on each side, so that highlighters do not process them whole
+static BufferRange line_range(const Buffer& buffer, LineCount line, ColumnCount tabstop, ByteCount margin,
+                              ColumnCount first_column, ColumnCount end_column, Optional<ByteCount> cursor_column)
+{
+    const StringView content = buffer[line];
+    if (margin == 0 or content.length() <= margin)
+        return full_line_range(buffer, line);
+
+    ByteCount begin = get_byte_to_column(buffer, tabstop, {line, first_column}) - margin;
+    ByteCount end = get_byte_to_column(buffer, tabstop, {line, end_column}) + margin;
+    if (cursor_column)
+    {
+        begin = std::min(begin, *cursor_column - margin);
+        end = std::max(end, *cursor_column + margin);
+    }
+    begin = std::max(0_byte, begin);
+    while (begin > 0 and not utf8::is_character_start(content[begin]))
+        --begin;
+    end = std::min(content.length(), end);
+    while (end < content.length() and not utf8::is_character_start(content[end]))
+        ++end;
+
+    return {{line, begin}, {line, end}};
+}
+
 const DisplayBuffer& Window::update_display_buffer(const Context& context)
 {
     ProfileScope profile{context.options()["debug"].get<DebugFlags>(), [&](std::chrono::microseconds duration) {
@@ -148,12 +179,31 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
         m_resize_hook_pending = true;
     }
 
+    const ByteCount margin = options()["long_line_margin"].get<int>();
+    const ColumnCount tabstop = options()["tabstop"].get<int>();
+    const auto cursor = context.selections().main().cursor();
+    const ColumnCount first_column = estimate_first_column(context, setup);
+
+    // Remember at which column cut lines start, to scroll them correctly
+    struct CutLine { LineCount line; ColumnCount column; };
+    Vector<CutLine, MemoryDomain::Display> cut_lines;
+    auto cut_column = [&](LineCount line) {
+        auto it = std::lower_bound(cut_lines.begin(), cut_lines.end(), line,
+                                   [](const CutLine& cut, LineCount line) { return cut.line < line; });
+        return it != cut_lines.end() and it->line == line ? it->column : 0_col;
+    };
+
     for (LineCount line = 0; line < setup.line_count; ++line)
     {
         LineCount buffer_line = setup.first_line + line;
         if (buffer_line >= buffer().line_count())
             break;
-        lines.emplace_back(AtomList{{buffer(), {buffer_line, {buffer_line, buffer()[buffer_line].length()}}}});
+        const BufferRange range = setup.full_lines ? full_line_range(buffer(), buffer_line)
+            : line_range(buffer(), buffer_line, tabstop, margin, first_column, first_column + m_dimensions.column,
+                         buffer_line == cursor.line ? cursor.column : Optional<ByteCount>{});
+        if (range.begin.column != 0 or range.end.column != buffer()[buffer_line].length())
+            cut_lines.push_back({buffer_line, get_column(buffer(), tabstop, range.begin)});
+        lines.emplace_back(AtomList{{buffer(), range}});
     }
 
     m_display_buffer.compute_range();
@@ -172,15 +222,17 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
             setup.first_line = lines.begin()->range().begin.line;
         }
 
-        auto max_first_column = cursor_pos->column - (setup.widget_columns + setup.scroll_offset.column);
+        const ColumnCount cursor_column = cursor_pos->column + cut_column(cursor.line);
+        auto max_first_column = cursor_column - (setup.widget_columns + setup.scroll_offset.column);
         setup.first_column = std::max(0_col, std::min(setup.first_column, max_first_column));
 
-        auto min_first_column = cursor_pos->column - (m_dimensions.column - setup.scroll_offset.column) + 1;
+        auto min_first_column = cursor_column - (m_dimensions.column - setup.scroll_offset.column) + 1;
         setup.first_column = std::max(setup.first_column, min_first_column);
     }
 
     for (auto& line : m_display_buffer.lines())
-        line.trim_from(setup.widget_columns, setup.first_column, m_dimensions.column);
+        line.trim_from(setup.widget_columns, std::max(0_col, setup.first_column - cut_column(line.range().begin.line)),
+                       m_dimensions.column);
     if (m_display_buffer.lines().size() > m_dimensions.line)
         m_display_buffer.lines().resize((size_t)m_dimensions.line);
 
@@ -192,9 +244,50 @@ const DisplayBuffer& Window::update_display_buffer(const Context& context)
     m_last_setup = build_setup(context);
     m_last_display_setup = setup;
 
+    const LineCount end_line = lines.empty() ? setup.first_line : lines.back().range().end.line + 1;
+    m_prefetch_ranges = {{end_line, std::min(end_line + m_dimensions.line, buffer().line_count())},
+                         {std::max(0_line, setup.first_line - m_dimensions.line), setup.first_line}};
+
     return m_display_buffer;
 }
 
+bool Window::prefetch_highlighting(const Context& context, TimePoint deadline)
+{
+    kak_assert(&buffer() == &context.buffer());
+    if (m_display_buffer.timestamp() != buffer().timestamp() or Clock::now() >= deadline)
+    {
+        m_prefetch_ranges.clear();
+        return false;
+    }
+
+    auto it = find_if(m_prefetch_ranges, [](const PrefetchRange& r) { return r.begin < r.end; });
+    if (it == m_prefetch_ranges.end())
+        return false;
+
+    // Work by quarter of screens to get back to the event loop, and handle
+    // eventual inputs, often enough.
+    const LineCount end = std::min(it->end, it->begin + std::max(1_line, m_dimensions.line / 4));
+    const ByteCount margin = options()["long_line_margin"].get<int>();
+    const ColumnCount tabstop = options()["tabstop"].get<int>();
+    const DisplaySetup& setup = m_last_display_setup;
+    DisplayBuffer display_buffer;
+    for (LineCount line = it->begin; line < end; ++line)
+    {
+        const BufferRange range = setup.full_lines ? full_line_range(buffer(), line)
+            : line_range(buffer(), line, tabstop, margin, setup.first_column,
+                         setup.first_column + m_dimensions.column, {});
+        display_buffer.lines().emplace_back(AtomList{{buffer(), range}});
+    }
+    display_buffer.compute_range();
+
+    const DisplaySetup prefetch_setup{it->begin, end - it->begin, setup.first_column,
+                                      setup.widget_columns, setup.scroll_offset, setup.full_lines};
+    m_builtin_highlighters.highlight({context, prefetch_setup, HighlightPass::Colorize, {}},
+                                     display_buffer, {{0,0}, buffer().end_coord()});
+    it->begin = end;
+    return any_of(m_prefetch_ranges, [](const PrefetchRange& r) { return r.begin < r.end; });
+}
+
 void Window::set_position(DisplayCoord position)
 {
     m_position.line = clamp(position.line, 0_line, buffer().line_count()-1);
@@ -220,6 +313,20 @@ void Window::run_resize_hook_ifn()
     }
 }
 
+// Mirrors the horizontal scrolling that ensure_cursor_visible will apply, so that
+// cut long lines contain the columns that will end up on screen
+ColumnCount Window::estimate_first_column(const Context& context, const DisplaySetup& setup) const
+{
+    if (not context.ensure_cursor_visible)
+        return setup.first_column;
+
+    const ColumnCount tabstop = options()["tabstop"].get<int>();
+    const ColumnCount cursor_column = get_column(buffer(), tabstop, context.selections().main().cursor());
+    auto first_column = std::min(setup.first_column, cursor_column - setup.scroll_offset.column);
+    first_column = std::max(first_column, cursor_column + setup.widget_columns - (m_dimensions.column - setup.scroll_offset.column) + 1);
+    return std::max(0_col, first_column);
+}
+
 static void check_display_setup(const DisplaySetup& setup, const Window& window)
 {
     kak_assert(setup.first_line >= 0 and setup.first_line < window.buffer().line_count());
@@ -1,6 +1,7 @@
 #ifndef window_hh_INCLUDED
 #define window_hh_INCLUDED
 
+#include "clock.hh"
 #include "display_buffer.hh"
 #include "highlighter_group.hh"
 #include "option.hh"
@@ -38,6 +39,11 @@ public:
 
     const DisplayBuffer& update_display_buffer(const Context& context);
 
+    // Highlight part of the screens below and above the displayed one so that
+    // highlighter caches are warm when scrolling there, returns true while
+    // there is some work left and deadline is not reached
+    bool prefetch_highlighting(const Context& context, TimePoint deadline);
+
     Optional<DisplayCoord> display_coord(BufferCoord coord) const;
     Optional<BufferCoord> buffer_coord(DisplayCoord coord) const;
 
@@ -56,6 +62,7 @@ private:
     Window(const Window&) = delete;
 
     DisplaySetup compute_display_setup(const Context& context) const;
+    ColumnCount estimate_first_column(const Context& context, const DisplaySetup& setup) const;
     void on_option_changed(const Option& option) override;
 
     friend class ClientManager;
@@ -84,6 +91,9 @@ private:
     };
     Setup build_setup(const Context& context) const;
     Setup m_last_setup;
+
+    struct PrefetchRange { LineCount begin, end; };
+    Vector<PrefetchRange, MemoryDomain::Display> m_prefetch_ranges;
 };
 
 }
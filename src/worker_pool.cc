@@ -0,0 +1,252 @@
+#include "worker_pool.hh"
+
+#include "buffer.hh"
+#include "buffer_utils.hh"
+#include "format.hh"
+#include "ranges.hh"
+#include "unit_tests.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+namespace Kakoune
+{
+
+void WorkerTask::cancel()
+{
+    if (m_job)
+        m_job->m_cancelled = true;
+    m_job.reset();
+}
+
+WorkerPool::WorkerPool(size_t thread_count)
+    : m_thread_count{std::max<size_t>(thread_count, 1)}
+{
+    open_notify_fds();
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop_workers();
+    m_notify_watcher.reset();
+    close_notify_fds();
+}
+
+size_t WorkerPool::default_thread_count()
+{
+    // leave a core to the main thread, workers are for a few heavy jobs
+    return clamp<size_t>(std::thread::hardware_concurrency(), 2, 5) - 1;
+}
+
+void WorkerPool::open_notify_fds()
+{
+#if defined(__linux__)
+    m_notify_read_fd = m_notify_write_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_notify_read_fd == -1)
+        throw runtime_error(format("unable to create eventfd: {}", strerror(errno)));
+#else
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw runtime_error(format("unable to create pipe: {}", strerror(errno)));
+    for (int fd : fds)
+    {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    m_notify_read_fd = fds[0];
+    m_notify_write_fd = fds[1];
+#endif
+
+    if (m_notify_watcher)
+        m_notify_watcher->reset_fd(m_notify_read_fd);
+    else
+        m_notify_watcher.emplace(m_notify_read_fd, FdEvents::Read, EventMode::Normal,
+                                 [this](FDWatcher&, FdEvents, EventMode) { run_completions(); });
+}
+
+void WorkerPool::close_notify_fds()
+{
+    if (m_notify_watcher)
+        m_notify_watcher->disable();
+    if (m_notify_write_fd != m_notify_read_fd)
+        close(m_notify_write_fd);
+    if (m_notify_read_fd != -1)
+        close(m_notify_read_fd);
+    m_notify_read_fd = m_notify_write_fd = -1;
+}
+
+void WorkerPool::push(RefPtr<WorkerJob> job)
+{
+    WorkerJob* raw_job = job.get();
+    m_jobs.push_back(std::move(job));
+    {
+        std::lock_guard lock{m_mutex};
+        m_pending.push_back(raw_job);
+    }
+    m_work_available.notify_one();
+    start_workers();
+}
+
+void WorkerPool::start_workers()
+{
+    while (m_threads.size() < m_thread_count)
+        m_threads.emplace_back([this] { worker_loop(); });
+}
+
+void WorkerPool::stop_workers()
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+    m_work_available.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+    m_threads.clear();
+    m_stopping = false;
+}
+
+void WorkerPool::reset_after_fork()
+{
+    // do not share the notification fd with the parent process
+    close_notify_fds();
+    open_notify_fds();
+
+    if (not m_completed.empty())
+        notify_completion();
+    if (not m_pending.empty())
+        start_workers();
+}
+
+void WorkerPool::worker_loop()
+{
+    MemoryStats stats[(size_t)MemoryDomain::Count] = {};
+    thread_memory_stats = stats;
+
+    while (true)
+    {
+        WorkerJob* job = nullptr;
+        {
+            std::unique_lock lock{m_mutex};
+            m_work_available.wait(lock, [this] { return m_stopping or not m_pending.empty(); });
+            if (m_stopping)
+                return;
+            job = m_pending.front();
+            m_pending.pop_front();
+        }
+
+        if (not job->m_cancelled)
+            job->run();
+
+        bool notify = false;
+        {
+            std::lock_guard lock{m_mutex};
+            // hand the allocations made by the job to the main thread,
+            // which will free them
+            std::copy(std::begin(stats), std::end(stats), job->m_memory_stats);
+            std::fill(std::begin(stats), std::end(stats), MemoryStats{});
+            notify = m_completed.empty();
+            m_completed.push_back(job);
+        }
+
+        if (notify)
+            notify_completion();
+    }
+}
+
+void WorkerPool::notify_completion()
+{
+    // an eventfd expects an 8 bytes counter increment
+    const uint64_t value = 1;
+    const size_t size = m_notify_write_fd == m_notify_read_fd ? sizeof(value) : 1;
+    [[maybe_unused]] auto res = ::write(m_notify_write_fd, &value, size);
+}
+
+void WorkerPool::run_completions()
+{
+    char buffer[64];
+    while (::read(m_notify_read_fd, buffer, sizeof(buffer)) > 0)
+    {}
+
+    std::deque<WorkerJob*> completed;
+    {
+        std::lock_guard lock{m_mutex};
+        std::swap(completed, m_completed);
+    }
+
+    for (auto* job : completed)
+    {
+        // memory stats are wrapping counters, so adding negative deltas works
+        for (size_t domain = 0; domain < (size_t)MemoryDomain::Count; ++domain)
+        {
+            auto& stats = memory_stats[domain];
+            auto& delta = job->m_memory_stats[domain];
+            stats.allocated_bytes += delta.allocated_bytes;
+            stats.allocation_count += delta.allocation_count;
+            stats.total_allocation_count += delta.total_allocation_count;
+        }
+
+        // keep the job alive while its completion runs
+        auto it = find_if(m_jobs, [&](auto& ptr) { return ptr.get() == job; });
+        kak_assert(it != m_jobs.end());
+        RefPtr<WorkerJob> job_ref = std::move(*it);
+        m_jobs.erase(it);
+
+        job->m_completed = true;
+        if (not job->m_cancelled)
+            job->complete();
+    }
+}
+
+void WorkerPool::report_error(StringView error)
+{
+    write_to_debug_buffer(format("worker job failed: {}", error));
+}
+
+UnitTest test_worker_pool{[]{
+    auto& pool = WorkerPool::instance();
+    // blocks until completions are notified, the deadline is only reached on failure
+    auto wait_for = [](auto&& predicate) {
+        const auto deadline = Clock::now() + std::chrono::seconds{2};
+        for (auto now = Clock::now(); not predicate() and now < deadline; now = Clock::now())
+            EventManager::instance().handle_next_events(EventMode::Normal, nullptr, deadline - now);
+        kak_assert(predicate());
+    };
+
+    // work reads a snapshot of the buffer lines, unaffected by later modifications
+    Buffer buffer("test", Buffer::Flags::None, BufferLines{StringData::create("line 1\n"), StringData::create("line 2\n")});
+    Vector<WorkerTask> tasks;
+    Vector<int> results;
+    for (int i = 0; i < 8; ++i)
+        tasks.push_back(pool.submit([lines = buffer.lines_snapshot(), i] {
+            ByteCount length = 0;
+            for (auto& line : lines)
+                length += line->strview().length();
+            return std::make_pair(i, length);
+        }, [&](std::pair<int, ByteCount> result) {
+            kak_assert(result.second == 14);
+            results.push_back(result.first);
+        }));
+
+    bool cancelled_done = false;
+    auto cancelled = pool.submit([] { return 1; }, [&](int) { cancelled_done = true; });
+    cancelled.cancel();
+
+    buffer.insert({0, 0}, "modified ");
+    wait_for([&] { return results.size() == 8; });
+    std::sort(results.begin(), results.end());
+    kak_assert((results == Vector<int>{0, 1, 2, 3, 4, 5, 6, 7}));
+    kak_assert(not cancelled_done);
+    kak_assert(not any_of(tasks, [](auto& task) { return task.pending(); }));
+
+    // do not keep threads around for sessions that never use the pool
+    pool.stop_workers();
+}};
+
+}
@@ -0,0 +1,164 @@
+#ifndef worker_pool_hh_INCLUDED
+#define worker_pool_hh_INCLUDED
+
+#include "event_manager.hh"
+#include "exception.hh"
+#include "memory.hh"
+#include "optional.hh"
+#include "ref_ptr.hh"
+#include "string.hh"
+#include "utils.hh"
+#include "vector.hh"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace Kakoune
+{
+
+// A job runs on a worker thread, then has its completion run on the main
+// thread. Jobs are only created, reference counted and destroyed on the
+// main thread, so work can capture main thread data such as buffer line
+// snapshots, as long as it only reads it.
+class WorkerJob : public RefCountable
+{
+public:
+    virtual ~WorkerJob() = default;
+
+private:
+    friend class WorkerPool;
+    friend class WorkerTask;
+
+    virtual void run() = 0;
+    virtual void complete() = 0;
+
+    std::atomic<bool> m_cancelled = false;
+    bool m_completed = false;
+    MemoryStats m_memory_stats[(size_t)MemoryDomain::Count] = {};
+};
+
+// Handle on a submitted job, its completion does not run once the
+// handle is cancelled or destroyed.
+class WorkerTask
+{
+public:
+    WorkerTask() = default;
+    WorkerTask(WorkerTask&&) = default;
+    WorkerTask& operator=(WorkerTask&& other) { cancel(); m_job = std::move(other.m_job); return *this; }
+    ~WorkerTask() { cancel(); }
+
+    bool pending() const { return m_job and not m_job->m_completed; }
+    void cancel();
+
+private:
+    friend class WorkerPool;
+    explicit WorkerTask(RefPtr<WorkerJob> job) : m_job{std::move(job)} {}
+
+    RefPtr<WorkerJob> m_job;
+};
+
+// The WorkerPool runs work off the main thread, and delivers its results
+// back through the event loop.
+//
+// Work should only read the data it captured, and neither free it nor touch
+// the editor state; runtime errors it throws are reported in the debug buffer.
+class WorkerPool : public Singleton<WorkerPool>
+{
+public:
+    WorkerPool(size_t thread_count = default_thread_count());
+    ~WorkerPool();
+
+    // runs work() on a worker thread, then done(result) on the main thread
+    template<typename Work, typename Done>
+    [[nodiscard]] WorkerTask submit(Work work, Done done)
+    {
+        using Result = std::invoke_result_t<Work&>;
+        static_assert(not std::is_void_v<Result>, "work needs to return a result");
+        static_assert(std::is_invocable_v<Done&, Result&&>);
+
+        struct Job : WorkerJob
+        {
+            Job(Work work, Done done) : work{std::move(work)}, done{std::move(done)} {}
+
+            void run() override
+            {
+                try
+                {
+                    result.emplace(work());
+                }
+                catch (runtime_error& err)
+                {
+                    error = err.what().str();
+                }
+                catch (...)
+                {
+                    error = "unknown error";
+                }
+            }
+
+            void complete() override
+            {
+                if (result)
+                    done(std::move(*result));
+                else
+                    report_error(error);
+            }
+
+            Work work;
+            Done done;
+            Optional<Result> result;
+            String error;
+        };
+
+        RefPtr<WorkerJob> job{new Job{std::move(work), std::move(done)}};
+        push(job);
+        return WorkerTask{std::move(job)};
+    }
+
+    // joins the worker threads, to be called before forking; workers are
+    // started again on the next submission or by reset_after_fork()
+    void stop_workers();
+
+    // to be called in a forked process that keeps using the pool
+    void reset_after_fork();
+
+    static size_t default_thread_count();
+
+private:
+    void push(RefPtr<WorkerJob> job);
+    void start_workers();
+    void worker_loop();
+    void run_completions();
+    void notify_completion();
+    void open_notify_fds();
+    void close_notify_fds();
+    static void report_error(StringView error);
+
+    const size_t m_thread_count;
+    Vector<std::thread> m_threads;
+
+    // jobs waiting for a worker and jobs waiting for their completion, only
+    // accessed with m_mutex held
+    std::mutex m_mutex;
+    std::condition_variable m_work_available;
+    std::deque<WorkerJob*> m_pending;
+    std::deque<WorkerJob*> m_completed;
+    bool m_stopping = false;
+
+    // keeps the jobs alive until their completion ran, main thread only
+    Vector<RefPtr<WorkerJob>, MemoryDomain::Events> m_jobs;
+
+    // workers signal completions through an eventfd, or a pipe where
+    // eventfd is not available
+    int m_notify_read_fd = -1;
+    int m_notify_write_fd = -1;
+    Optional<FDWatcher> m_notify_watcher;
+};
+
+}
+
+#endif // worker_pool_hh_INCLUDED